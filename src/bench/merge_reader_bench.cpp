@@ -0,0 +1,155 @@
+// Compares MergeReader with a binary heap merge of the same inputs for fan-ins
+// from 4 to 256. Run as
+//
+//     ./merge_reader_bench [row-count]
+//
+// and it prints the merge throughput in rows per second.
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+#include "geosick/merge_reader.hpp"
+
+using namespace geosick;
+
+namespace {
+    class VectorReader final: public GeoRowReader {
+        const std::vector<GeoRow>* m_rows;
+        size_t m_pos = 0;
+    public:
+        explicit VectorReader(const std::vector<GeoRow>* rows): m_rows(rows) {}
+
+        virtual size_t read_batch(ArrayView<GeoRow> out) override {
+            size_t count = std::min(out.size(), m_rows->size() - m_pos);
+            std::copy(m_rows->begin() + (ptrdiff_t)m_pos,
+                m_rows->begin() + (ptrdiff_t)(m_pos + count), out.begin());
+            m_pos += count;
+            return count;
+        }
+    };
+
+    // The merge that MergeReader replaced: a heap of inputs that compares
+    // whole rows and reads every input in batches
+    class HeapMergeReader final: public GeoRowReader {
+        struct Input {
+            std::unique_ptr<GeoRowReader> reader;
+            std::vector<GeoRow> buffer;
+            size_t pos = 0;
+        };
+        std::vector<Input> m_inputs;
+        std::vector<size_t> m_heap;
+
+        static bool row_less(const GeoRow& row1, const GeoRow& row2) {
+            if (row1.user_id != row2.user_id) { return row1.user_id < row2.user_id; }
+            return row1.timestamp_utc_s < row2.timestamp_utc_s;
+        }
+
+        bool heap_greater(size_t idx1, size_t idx2) const {
+            const Input& input1 = m_inputs[idx1];
+            const Input& input2 = m_inputs[idx2];
+            return row_less(input2.buffer[input2.pos], input1.buffer[input1.pos]);
+        }
+
+        static bool refill(Input& input) {
+            input.buffer.resize(ROW_BATCH_SIZE);
+            input.buffer.resize(input.reader->read_batch(make_view(input.buffer)));
+            input.pos = 0;
+            return !input.buffer.empty();
+        }
+
+    public:
+        explicit HeapMergeReader(std::vector<std::unique_ptr<GeoRowReader>> readers) {
+            for (auto& reader: readers) {
+                m_inputs.emplace_back();
+                m_inputs.back().reader = std::move(reader);
+            }
+            auto cmp = [this](size_t i, size_t j) { return this->heap_greater(i, j); };
+            for (size_t i = 0; i < m_inputs.size(); ++i) {
+                if (refill(m_inputs[i])) {
+                    m_heap.push_back(i);
+                    std::push_heap(m_heap.begin(), m_heap.end(), cmp);
+                }
+            }
+        }
+
+        virtual size_t read_batch(ArrayView<GeoRow> out) override {
+            auto cmp = [this](size_t i, size_t j) { return this->heap_greater(i, j); };
+            size_t count = 0;
+            while (count < out.size() && !m_heap.empty()) {
+                std::pop_heap(m_heap.begin(), m_heap.end(), cmp);
+                Input& input = m_inputs[m_heap.back()];
+                out[count++] = input.buffer[input.pos++];
+                if (input.pos < input.buffer.size() || refill(input)) {
+                    std::push_heap(m_heap.begin(), m_heap.end(), cmp);
+                } else {
+                    m_heap.pop_back();
+                }
+            }
+            return count;
+        }
+    };
+
+    // Splits the rows into fan_in sorted runs
+    std::vector<std::vector<GeoRow>> make_runs(size_t row_count, size_t fan_in) {
+        std::mt19937 rng(fan_in);
+        std::vector<std::vector<GeoRow>> runs(fan_in);
+        for (size_t i = 0; i < row_count; ++i) {
+            GeoRow row {};
+            row.user_id = uint32_t(rng() % 100000);
+            row.timestamp_utc_s = int32_t(rng() % (14*24*60*60));
+            runs[rng() % fan_in].push_back(row);
+        }
+        for (auto& run: runs) {
+            std::sort(run.begin(), run.end(), [](const GeoRow& row1, const GeoRow& row2) {
+                return get_row_key(row1) < get_row_key(row2);
+            });
+        }
+        return runs;
+    }
+
+    double measure_rows_per_s(GeoRowReader& reader, size_t row_count) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<GeoRow> batch(ROW_BATCH_SIZE);
+        size_t read_count = 0;
+        uint64_t prev_key = 0;
+        while (size_t batch_size = reader.read_batch(make_view(batch))) {
+            for (size_t i = 0; i < batch_size; ++i) {
+                uint64_t key = get_row_key(batch[i]);
+                if (key < prev_key) {
+                    throw std::runtime_error("Merged rows are not sorted");
+                }
+                prev_key = key;
+            }
+            read_count += batch_size;
+        }
+        if (read_count != row_count) {
+            throw std::runtime_error("Merge lost some rows");
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return double(row_count) / elapsed.count();
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t row_count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 8000000;
+    std::cout << "fan-in  heap rows/s  loser tree rows/s" << std::endl;
+    for (size_t fan_in = 4; fan_in <= 256; fan_in *= 2) {
+        auto runs = make_runs(row_count, fan_in);
+
+        std::vector<std::unique_ptr<GeoRowReader>> heap_readers;
+        MergeReader merger;
+        for (const auto& run: runs) {
+            heap_readers.push_back(std::make_unique<VectorReader>(&run));
+            merger.add_reader(std::make_unique<VectorReader>(&run));
+        }
+        HeapMergeReader heap_merger(std::move(heap_readers));
+
+        double heap_rate = measure_rows_per_s(heap_merger, row_count);
+        double tree_rate = measure_rows_per_s(merger, row_count);
+        std::cout << fan_in << "  " << heap_rate << "  " << tree_rate << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+namespace geosick {
+
+// Limits the rate of bytes that are passed to acquire() by all threads
+// together; a rate of zero means no limit.
+class BandwidthLimiter {
+    using Clock = std::chrono::steady_clock;
+    double m_bytes_per_s;
+    std::mutex m_mutex;
+    Clock::time_point m_next_time;
+public:
+    explicit BandwidthLimiter(double bytes_per_s):
+        m_bytes_per_s(bytes_per_s), m_next_time(Clock::now()) {}
+
+    // Waits until the bytes fit into the budget
+    void acquire(size_t bytes) {
+        if (m_bytes_per_s <= 0) { return; }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto wait_time = std::max(m_next_time, Clock::now());
+        m_next_time = wait_time + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(double(bytes) / m_bytes_per_s));
+        lock.unlock();
+        std::this_thread::sleep_until(wait_time);
+    }
+};
+
+}
@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include "geosick/compact_run.hpp"
+
+namespace geosick {
+
+// Bits of the flags byte that starts every encoded row
+enum : uint8_t {
+    FLAG_USER_ID = 1 << 0,
+    FLAG_ACCURACY = 1 << 1,
+    FLAG_ALTITUDE = 1 << 2,
+    FLAG_HEADING = 1 << 3,
+    FLAG_VELOCITY = 1 << 4,
+};
+
+static void put_varint(std::vector<uint8_t>& bytes, uint64_t value) {
+    while (value >= 0x80) {
+        bytes.push_back(uint8_t(value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back(uint8_t(value));
+}
+
+static void put_zigzag(std::vector<uint8_t>& bytes, int64_t value) {
+    put_varint(bytes, (uint64_t(value) << 1) ^ uint64_t(value >> 63));
+}
+
+static uint64_t get_varint(const uint8_t*& ptr, const uint8_t* end) {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (ptr == end) {
+            throw std::runtime_error("Truncated varint in compact run");
+        }
+        uint8_t byte = *ptr++;
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) { return value; }
+    }
+    throw std::runtime_error("Invalid varint in compact run");
+}
+
+static int64_t get_zigzag(const uint8_t*& ptr, const uint8_t* end) {
+    uint64_t value = get_varint(ptr, end);
+    return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+// The first row of every block is encoded relative to this row
+static GeoRow initial_row() {
+    GeoRow row;
+    row.user_id = 0;
+    row.timestamp_utc_s = 0;
+    row.lat = 0;
+    row.lon = 0;
+    row.accuracy_m = 0;
+    return row;
+}
+
+CompactRunWriter::CompactRunWriter(const std::filesystem::path& path) {
+    m_file = std::fopen(path.c_str(), "w");
+    if (!m_file) {
+        throw std::runtime_error("Could not open file for writing: " + path.string());
+    }
+    m_block.reserve(COMPACT_BLOCK_ROW_COUNT);
+}
+
+CompactRunWriter::~CompactRunWriter() {
+    // like FileWriter, flush the rows that are still buffered in m_block, but
+    // the destructor must not throw
+    try {
+        this->close();
+    } catch (const std::exception& ex) {
+        std::cerr << "Could not flush compact run: " << ex.what() << std::endl;
+        if (m_file) {
+            std::fclose(m_file);
+        }
+    }
+}
+
+void CompactRunWriter::write(ArrayView<const GeoRow> rows) {
+    if (!m_file) {
+        throw std::runtime_error("Cannot write to a closed file");
+    }
+    for (const GeoRow& row: rows) {
+        m_block.push_back(row);
+        if (m_block.size() >= COMPACT_BLOCK_ROW_COUNT) {
+            this->write_block();
+        }
+    }
+}
+
+void CompactRunWriter::write_block() {
+    if (m_block.empty()) { return; }
+
+    m_bytes.clear();
+    GeoRow prev = initial_row();
+    for (const GeoRow& row: m_block) {
+        uint8_t flags = 0;
+        if (row.user_id != prev.user_id) { flags |= FLAG_USER_ID; }
+        if (row.accuracy_m != prev.accuracy_m) { flags |= FLAG_ACCURACY; }
+        if (row.altitude_m != UINT16_MAX) { flags |= FLAG_ALTITUDE; }
+        if (row.heading_deg != UINT16_MAX) { flags |= FLAG_HEADING; }
+        if (row.velocity_mps != 0) { flags |= FLAG_VELOCITY; }
+
+        m_bytes.push_back(flags);
+        if (flags & FLAG_USER_ID) {
+            put_zigzag(m_bytes, int64_t(row.user_id) - int64_t(prev.user_id));
+        }
+        put_zigzag(m_bytes, int64_t(row.timestamp_utc_s) - int64_t(prev.timestamp_utc_s));
+        put_zigzag(m_bytes, int64_t(row.lat) - int64_t(prev.lat));
+        put_zigzag(m_bytes, int64_t(row.lon) - int64_t(prev.lon));
+        if (flags & FLAG_ACCURACY) { put_varint(m_bytes, row.accuracy_m); }
+        if (flags & FLAG_ALTITUDE) { put_varint(m_bytes, row.altitude_m); }
+        if (flags & FLAG_HEADING) { put_varint(m_bytes, row.heading_deg); }
+        if (flags & FLAG_VELOCITY) { put_zigzag(m_bytes, row.velocity_mps); }
+        prev = row;
+    }
+
+    CompactBlockHeader header;
+    header.row_count = uint32_t(m_block.size());
+    header.byte_size = uint32_t(m_bytes.size());
+    header.first_user_id = m_block.front().user_id;
+    header.last_user_id = m_block.back().user_id;
+    if (std::fwrite(&header, sizeof(header), 1, m_file) != 1 ||
+        std::fwrite(m_bytes.data(), 1, m_bytes.size(), m_file) != m_bytes.size())
+    {
+        throw std::runtime_error("Error when writing compact run to file");
+    }
+
+    m_row_count += m_block.size();
+    m_byte_count += sizeof(header) + m_bytes.size();
+    m_block.clear();
+}
+
+void CompactRunWriter::close() {
+    if (m_file) {
+        this->write_block();
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+CompactRunReader::CompactRunReader(const std::filesystem::path& path) {
+    m_file = std::fopen(path.c_str(), "r");
+    if (!m_file) {
+        throw std::runtime_error("Could not open file for reading: " + path.string());
+    }
+
+    // build the index of blocks by skipping over their contents
+    long offset = 0;
+    CompactBlockHeader header;
+    while (std::fread(&header, sizeof(header), 1, m_file) == 1) {
+        offset += long(sizeof(header));
+        m_blocks.push_back(Block { header, offset });
+        offset += long(header.byte_size);
+        if (std::fseek(m_file, offset, SEEK_SET) != 0) {
+            this->close();
+            throw std::runtime_error("Could not seek in compact run: " + path.string());
+        }
+    }
+    if (std::ferror(m_file)) {
+        this->close();
+        throw std::runtime_error("Error when reading compact run: " + path.string());
+    }
+}
+
+std::vector<CompactBlockHeader> CompactRunReader::get_block_headers() const {
+    std::vector<CompactBlockHeader> headers;
+    headers.reserve(m_blocks.size());
+    for (const auto& block: m_blocks) {
+        headers.push_back(block.header);
+    }
+    return headers;
+}
+
+void CompactRunReader::set_user_range(uint64_t user_begin, uint64_t user_end) {
+    m_user_begin = user_begin;
+    m_user_end = user_end;
+    m_block_idx = size_t(std::partition_point(m_blocks.begin(), m_blocks.end(),
+        [&](const Block& block) { return block.header.last_user_id < user_begin; })
+        - m_blocks.begin());
+    m_rows.clear();
+    m_row_pos = 0;
+}
+
+bool CompactRunReader::read_block() {
+    if (!m_file || m_block_idx >= m_blocks.size()) { return false; }
+    const Block& block = m_blocks[m_block_idx++];
+    if (block.header.first_user_id >= m_user_end) { return false; }
+
+    m_bytes.resize(block.header.byte_size);
+    if (std::fseek(m_file, block.offset, SEEK_SET) != 0 ||
+        std::fread(m_bytes.data(), 1, m_bytes.size(), m_file) != m_bytes.size())
+    {
+        throw std::runtime_error("Error when reading compact run block");
+    }
+
+    const uint8_t* ptr = m_bytes.data();
+    const uint8_t* end = ptr + m_bytes.size();
+    m_rows.clear();
+    m_row_pos = 0;
+    GeoRow row = initial_row();
+    for (uint32_t i = 0; i < block.header.row_count; ++i) {
+        if (ptr == end) {
+            throw std::runtime_error("Truncated compact run block");
+        }
+        uint8_t flags = *ptr++;
+        if (flags & FLAG_USER_ID) {
+            row.user_id = uint32_t(int64_t(row.user_id) + get_zigzag(ptr, end));
+        }
+        row.timestamp_utc_s = int32_t(row.timestamp_utc_s + get_zigzag(ptr, end));
+        row.lat = int32_t(row.lat + get_zigzag(ptr, end));
+        row.lon = int32_t(row.lon + get_zigzag(ptr, end));
+        if (flags & FLAG_ACCURACY) { row.accuracy_m = uint16_t(get_varint(ptr, end)); }
+        row.altitude_m = (flags & FLAG_ALTITUDE) ? uint16_t(get_varint(ptr, end)) : UINT16_MAX;
+        row.heading_deg = (flags & FLAG_HEADING) ? uint16_t(get_varint(ptr, end)) : UINT16_MAX;
+        row.velocity_mps = (flags & FLAG_VELOCITY) ? int32_t(get_zigzag(ptr, end)) : 0;
+
+        // only the blocks at the ends of the user range need to be filtered
+        if (row.user_id >= m_user_begin && row.user_id < m_user_end) {
+            m_rows.push_back(row);
+        }
+    }
+    return true;
+}
+
+size_t CompactRunReader::read_batch(ArrayView<GeoRow> out) {
+    size_t count = 0;
+    while (count < out.size()) {
+        if (m_row_pos == m_rows.size()) {
+            if (!this->read_block()) { break; }
+            continue;
+        }
+        size_t block_count = std::min(out.size() - count, m_rows.size() - m_row_pos);
+        std::copy(m_rows.begin() + (ptrdiff_t)m_row_pos,
+            m_rows.begin() + (ptrdiff_t)(m_row_pos + block_count),
+            out.begin() + count);
+        m_row_pos += block_count;
+        count += block_count;
+    }
+    return count;
+}
+
+void CompactRunReader::close() {
+    if (m_file) {
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+}
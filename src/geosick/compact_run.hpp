@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+#include "geosick/geo_row_reader.hpp"
+#include "geosick/geo_row_writer.hpp"
+
+namespace geosick {
+
+// The compact run format stores GeoRow-s in blocks of up to
+// COMPACT_BLOCK_ROW_COUNT rows. Each block starts with a CompactBlockHeader,
+// followed by the rows encoded as differences from the previous row in the
+// block, stored as (zigzag) varints.
+static constexpr size_t COMPACT_BLOCK_ROW_COUNT = 4096;
+
+struct CompactBlockHeader {
+    uint32_t row_count;
+    uint32_t byte_size;
+    uint32_t first_user_id;
+    uint32_t last_user_id;
+};
+
+class CompactRunWriter final: public GeoRowWriter {
+    FILE* m_file = nullptr;
+    std::vector<GeoRow> m_block;
+    std::vector<uint8_t> m_bytes;
+    uint64_t m_row_count = 0;
+    uint64_t m_byte_count = 0;
+
+    void write_block();
+public:
+    explicit CompactRunWriter(const std::filesystem::path& path);
+    ~CompactRunWriter();
+    CompactRunWriter(const CompactRunWriter&) = delete;
+    CompactRunWriter& operator=(const CompactRunWriter&) = delete;
+
+    virtual void write(ArrayView<const GeoRow> rows) override;
+    virtual void close() override;
+
+    uint64_t get_row_count() const { return m_row_count; }
+    uint64_t get_byte_count() const { return m_byte_count; }
+};
+
+class CompactRunReader final: public GeoRowReader {
+    struct Block {
+        CompactBlockHeader header;
+        long offset;
+    };
+
+    FILE* m_file = nullptr;
+    std::vector<Block> m_blocks;
+    size_t m_block_idx = 0;
+    uint64_t m_user_begin = 0;
+    uint64_t m_user_end = UINT64_C(1) << 32;
+    std::vector<uint8_t> m_bytes;
+    std::vector<GeoRow> m_rows;
+    size_t m_row_pos = 0;
+
+    bool read_block();
+public:
+    explicit CompactRunReader(const std::filesystem::path& path);
+    ~CompactRunReader() { this->close(); }
+    CompactRunReader(const CompactRunReader&) = delete;
+    CompactRunReader& operator=(const CompactRunReader&) = delete;
+
+    // Returns the headers of all blocks in the file
+    std::vector<CompactBlockHeader> get_block_headers() const;
+    // Restricts the reader to rows with user_id in [user_begin, user_end); only
+    // the blocks that overlap this range are decoded. The file must be sorted
+    // by user_id.
+    void set_user_range(uint64_t user_begin, uint64_t user_end);
+
+    virtual size_t read_batch(ArrayView<GeoRow> out) override;
+    void close();
+};
+
+}
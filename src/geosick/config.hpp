@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <string>
 
 namespace geosick {
@@ -10,11 +11,20 @@ struct Config {
         std::string user;
         std::string password;
         std::string ssl_mode;
+        uint32_t bulk_batch_size;
+        std::string dedup_mode;
+        bool filter_rows;
+        uint32_t read_connections;
+        uint32_t parse_threads;
+        bool binary_protocol;
     } mysql;
 
     struct Search {
-        uint32_t bucket_count;
         double bin_delta_m;
+        uint32_t partition_count;
+        uint32_t thread_count;
+        std::string index_layout;
+        uint32_t build_threads;
     } search;
 
     struct Notify {
@@ -23,12 +33,24 @@ struct Config {
         double json_select;
         bool use_mysql;
         double mysql_min_score;
+        bool mysql_streaming;
+        uint32_t mysql_queue_batches;
     } notify;
 
     uint32_t range_days;
     uint32_t period_s;
     std::string temp_dir;
+    std::string snapshot_dir;
+    bool compact_temp_files;
+    uint32_t sort_threads;
+    std::string ingest_strategy;
+    uint32_t partition_bucket_count;
+    uint32_t merge_threads;
+    uint32_t merge_fan_in;
+    double merge_bandwidth_mb_s;
     uint32_t row_buffer_size;
+    uint64_t memory_budget_bytes;
+    bool overlap_build;
 };
 
 }
@@ -3,12 +3,11 @@
 #include <filesystem>
 #include <string>
 #include <unistd.h>
-#include "geosick/geo_row.hpp"
-#include "geosick/slice.hpp"
+#include "geosick/geo_row_writer.hpp"
 
 namespace geosick {
 
-class FileWriter final {
+class FileWriter final: public GeoRowWriter {
     FILE* m_file = nullptr;
 public:
     explicit FileWriter(const std::filesystem::path& path) {
@@ -24,7 +23,7 @@ public:
         this->write(make_view(&row, &row + 1));
     }
 
-    void write(ArrayView<const GeoRow> rows) {
+    virtual void write(ArrayView<const GeoRow> rows) override {
         if (!m_file) {
             throw std::runtime_error("Cannot write to a closed file");
         }
@@ -34,7 +33,14 @@ public:
         }
     }
 
-    void close() {
+    // Flushes the written rows to the disk
+    void sync() {
+        if (m_file && (std::fflush(m_file) != 0 || ::fsync(fileno(m_file)) != 0)) {
+            throw std::runtime_error("Error when syncing file");
+        }
+    }
+
+    virtual void close() override {
         if (m_file) {
             std::fclose(m_file);
             m_file = nullptr;
@@ -14,4 +14,11 @@ struct GeoRow {
     int32_t velocity_mps = 0;
 };
 
+// Packs (user_id, timestamp_utc_s) into a single key, so that comparing the
+// keys orders the rows by user_id first and by timestamp second
+inline uint64_t get_row_key(const GeoRow& row) {
+    return (uint64_t(row.user_id) << 32)
+        | uint64_t(uint32_t(row.timestamp_utc_s) ^ 0x80000000u);
+}
+
 }
@@ -1,13 +1,28 @@
 #pragma once
-#include <optional>
+#include <stdexcept>
 #include "geosick/geo_row.hpp"
+#include "geosick/slice.hpp"
 
 namespace geosick {
 
+// Number of rows that are passed between readers and their consumers at once
+static constexpr size_t ROW_BATCH_SIZE = 4096;
+
 class GeoRowReader {
 public:
     virtual ~GeoRowReader() {}
-    virtual std::optional<GeoRow> read() = 0;
+    // Reads up to out.size() rows into out and returns the number of rows that
+    // were read. Returns 0 only when there are no more rows.
+    virtual size_t read_batch(ArrayView<GeoRow> out) = 0;
+
+    // Readers that already hold their rows in memory can hand them out without
+    // copying. read_view() returns up to max_count rows that stay valid until
+    // the reader is destroyed, or an empty view when there are no more rows.
+    virtual bool has_views() const { return false; }
+    virtual ArrayView<const GeoRow> read_view(size_t max_count) {
+        (void)max_count;
+        throw std::logic_error("GeoRowReader does not support views");
+    }
 };
 
 }
@@ -0,0 +1,15 @@
+#pragma once
+#include "geosick/geo_row.hpp"
+#include "geosick/slice.hpp"
+
+namespace geosick {
+
+class GeoRowWriter {
+public:
+    virtual ~GeoRowWriter() {}
+    virtual void write(ArrayView<const GeoRow> rows) = 0;
+    // Writes out all buffered rows; no rows can be written after close()
+    virtual void close() = 0;
+};
+
+}
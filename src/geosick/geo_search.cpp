@@ -4,9 +4,143 @@
 #include <iostream>
 #include "geosick/geo_distance.hpp"
 #include "geosick/geo_search.hpp"
+#include "geosick/thread_pool.hpp"
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 namespace geosick {
 
+// Number of points that are tested at once by the AVX2 filter
+static constexpr size_t SIMD_WIDTH = 8;
+// Relative margin that covers the rounding errors of the float filter; points
+// that are closer to the circle than this are tested exactly
+static constexpr float FILTER_MARGIN = 1e-4f;
+
+// Calls fun(task_idx) for every task in [0, task_count), in parallel if there
+// is a pool, and waits for all of them
+template<class F>
+static void run_tasks(ThreadPool* pool, size_t task_count, const F& fun) {
+    if (!pool) {
+        for (size_t task_idx = 0; task_idx < task_count; ++task_idx) { fun(task_idx); }
+        return;
+    }
+    std::vector<std::future<void>> futures;
+    for (size_t task_idx = 0; task_idx < task_count; ++task_idx) {
+        futures.push_back(pool->submit([&fun, task_idx]() { fun(task_idx); }));
+    }
+    for (auto& future: futures) { future.get(); }
+}
+
+namespace {
+// A query circle with bounds on the squared meters per E7 degree of longitude,
+// valid for all points of a single cell. The distance of a point is bounded by
+//   lat_coef*dlat^2 + lon_coef_lo*dlon^2 <= distance^2
+//   lat_coef*dlat^2 + lon_coef_hi*dlon^2 >= distance^2
+struct CircleFilter {
+    int32_t lat, lon;
+    uint32_t radius_m;
+    float lat_coef;
+    float lon_coef_lo;
+    float lon_coef_hi;
+};
+}
+
+// The reference test, which decides the points that the filter cannot
+static bool test_point_exact(const CircleFilter& filter,
+    int32_t lat, int32_t lon, float radius_m)
+{
+    double distance_pow2 = pow2_geo_distance_fast_m(lat, lon, filter.lat, filter.lon);
+    double max_distance = (double)filter.radius_m + (double)radius_m;
+    return !(distance_pow2 > max_distance*max_distance);
+}
+
+static uint64_t filter_points_scalar(const CircleFilter& filter,
+    const int32_t* lats, const int32_t* lons, const float* radii,
+    const uint32_t* user_ids, size_t count,
+    std::vector<uint32_t>& out_user_ids)
+{
+    uint64_t pass_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        float dlat = float(lats[i] - filter.lat);
+        float dlon = float(lons[i] - filter.lon);
+        float max_distance = float(filter.radius_m) + radii[i];
+        float max_pow2 = max_distance*max_distance;
+        float lat_pow2 = filter.lat_coef*dlat*dlat;
+        float dist_lo = lat_pow2 + filter.lon_coef_lo*dlon*dlon;
+        float dist_hi = lat_pow2 + filter.lon_coef_hi*dlon*dlon;
+
+        bool pass;
+        if (dist_hi*(1.f + FILTER_MARGIN) < max_pow2) {
+            pass = true;
+        } else if (dist_lo > max_pow2*(1.f + FILTER_MARGIN)) {
+            pass = false;
+        } else {
+            pass = test_point_exact(filter, lats[i], lons[i], radii[i]);
+        }
+        if (pass) {
+            out_user_ids.push_back(user_ids[i]);
+            ++pass_count;
+        }
+    }
+    return pass_count;
+}
+
+#ifdef __x86_64__
+// Same as filter_points_scalar(), but classifies SIMD_WIDTH points at once.
+// The arrays must be readable up to count rounded up to SIMD_WIDTH.
+__attribute__((target("avx2")))
+static uint64_t filter_points_avx2(const CircleFilter& filter,
+    const int32_t* lats, const int32_t* lons, const float* radii,
+    const uint32_t* user_ids, size_t count,
+    std::vector<uint32_t>& out_user_ids)
+{
+    const __m256i query_lat = _mm256_set1_epi32(filter.lat);
+    const __m256i query_lon = _mm256_set1_epi32(filter.lon);
+    const __m256 query_radius = _mm256_set1_ps(float(filter.radius_m));
+    const __m256 lat_coef = _mm256_set1_ps(filter.lat_coef);
+    const __m256 lon_coef_lo = _mm256_set1_ps(filter.lon_coef_lo);
+    const __m256 lon_coef_hi = _mm256_set1_ps(filter.lon_coef_hi);
+    const __m256 margin = _mm256_set1_ps(1.f + FILTER_MARGIN);
+
+    uint64_t pass_count = 0;
+    for (size_t i = 0; i < count; i += SIMD_WIDTH) {
+        __m256 dlat = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(lats + i)), query_lat));
+        __m256 dlon = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(lons + i)), query_lon));
+        __m256 max_distance = _mm256_add_ps(query_radius, _mm256_loadu_ps(radii + i));
+        __m256 max_pow2 = _mm256_mul_ps(max_distance, max_distance);
+        __m256 lat_pow2 = _mm256_mul_ps(lat_coef, _mm256_mul_ps(dlat, dlat));
+        __m256 dlon_pow2 = _mm256_mul_ps(dlon, dlon);
+        __m256 dist_lo = _mm256_add_ps(lat_pow2, _mm256_mul_ps(lon_coef_lo, dlon_pow2));
+        __m256 dist_hi = _mm256_add_ps(lat_pow2, _mm256_mul_ps(lon_coef_hi, dlon_pow2));
+
+        uint32_t accept_mask = uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(
+            _mm256_mul_ps(dist_hi, margin), max_pow2, _CMP_LT_OQ)));
+        uint32_t reject_mask = uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(
+            dist_lo, _mm256_mul_ps(max_pow2, margin), _CMP_GT_OQ)));
+        size_t lane_count = std::min(SIMD_WIDTH, count - i);
+        uint32_t lane_mask = (1u << lane_count) - 1;
+        uint32_t exact_mask = ~(accept_mask | reject_mask) & lane_mask;
+        accept_mask &= lane_mask;
+
+        for (; exact_mask != 0; exact_mask &= exact_mask - 1) {
+            size_t j = i + size_t(__builtin_ctz(exact_mask));
+            if (test_point_exact(filter, lats[j], lons[j], radii[j])) {
+                accept_mask |= 1u << (j - i);
+            }
+        }
+        for (; accept_mask != 0; accept_mask &= accept_mask - 1) {
+            size_t j = i + size_t(__builtin_ctz(accept_mask));
+            out_user_ids.push_back(user_ids[j]);
+            ++pass_count;
+        }
+    }
+    return pass_count;
+}
+#endif
+
 GeoSearch::LatLonBins GeoSearch::get_bins(
     int32_t lat, int32_t lon, uint32_t radius) const
 {
@@ -28,9 +162,7 @@ GeoSearch::LatLonBins GeoSearch::get_bins(
     };
 }
 
-uint32_t GeoSearch::get_hash(
-    int32_t lat_bin, int32_t lon_bin, int32_t time_index) const
-{
+uint32_t GeoSearch::get_hash(const CellKey& key) {
     // https://en.wikipedia.org/wiki/MurmurHash
     auto murmur_add = [](uint32_t h, uint32_t k) -> uint32_t {
         k *= 0xcc9e2d51;
@@ -43,9 +175,9 @@ uint32_t GeoSearch::get_hash(
     };
 
     uint32_t h = 0x8d0e03f0;
-    h = murmur_add(h, uint32_t(lat_bin));
-    h = murmur_add(h, uint32_t(lon_bin));
-    h = murmur_add(h, uint32_t(time_index));
+    h = murmur_add(h, uint32_t(key.lat_bin));
+    h = murmur_add(h, uint32_t(key.lon_bin));
+    h = murmur_add(h, uint32_t(key.time_index));
 
     h ^= h >> 16;
 	h *= 0x85ebca6b;
@@ -61,116 +193,351 @@ GeoSearch::GeoSearch(const Config& cfg, ArrayView<const GeoSample> samples) {
         cfg.search.bin_delta_m * M_TO_DEG_E7);
     m_lon_delta = (int32_t)std::ceil(
         cfg.search.bin_delta_m * M_TO_DEG_E7 * std::cos(MEAN_LAT_E7*DEG_E7_TO_RAD));
-    m_bucket_count = cfg.search.bucket_count;
 
-    std::vector<std::vector<UserPoint>> buckets(m_bucket_count);
-    size_t point_count = 0;
+#ifdef __x86_64__
+    m_use_avx2 = __builtin_cpu_supports("avx2");
+#else
+    m_use_avx2 = false;
+#endif
+    if (cfg.search.index_layout == "cells") {
+        m_time_slices = false;
+    } else if (cfg.search.index_layout == "time_slices") {
+        m_time_slices = true;
+    } else {
+        throw std::runtime_error("Invalid value of search.index_layout: '"
+            + cfg.search.index_layout + "'");
+    }
+
+    std::unique_ptr<ThreadPool> pool;
+    size_t chunk_count = 1;
+    if (cfg.search.build_threads > 1) {
+        pool = std::make_unique<ThreadPool>(cfg.search.build_threads);
+        chunk_count = cfg.search.build_threads;
+    }
+
+    // The points are grouped into slices by time index. Every chunk of
+    // samples counts its points in each slice, and the points are then
+    // scattered into a single array, ordered by slice, then by chunk and then
+    // by sample, so sorting each slice stably gives the same order as a
+    // stable sort of all points.
+    int32_t min_time_index = INT32_MAX;
+    int32_t max_time_index = INT32_MIN;
     for (const auto& sample: samples) {
-        auto bins = this->get_bins(sample.lat, sample.lon, sample.accuracy_m);
-        for (int32_t i = bins.lat_first; i <= bins.lat_last; ++i) {
-            for (int32_t j = bins.lon_first; j <= bins.lon_last; ++j) {
-                uint32_t hash = this->get_hash(i, j, sample.time_index);
-                size_t bucket_idx = hash % buckets.size();
-                buckets.at(bucket_idx).push_back(UserPoint {
-                    .time_index = sample.time_index,
-                    .lat = sample.lat,
-                    .lon = sample.lon,
-                    .hash = hash,
-                    .radius_m = sample.accuracy_m,
-                    .user_id = sample.user_id,
-                });
-                ++point_count;
+        min_time_index = std::min(min_time_index, sample.time_index);
+        max_time_index = std::max(max_time_index, sample.time_index);
+    }
+    size_t slice_count = samples.size() == 0 ? 0
+        : size_t(max_time_index - min_time_index) + 1;
+    auto get_chunk = [&](size_t chunk_idx) {
+        return std::make_pair(samples.size() * chunk_idx / chunk_count,
+            samples.size() * (chunk_idx + 1) / chunk_count);
+    };
+
+    std::vector<LatLonBins> sample_bins(samples.size());
+    std::vector<std::vector<size_t>> chunk_offsets(chunk_count);
+    run_tasks(pool.get(), chunk_count, [&](size_t chunk_idx) {
+        auto& counts = chunk_offsets[chunk_idx];
+        counts.assign(slice_count, 0);
+        auto [begin, end] = get_chunk(chunk_idx);
+        for (size_t i = begin; i < end; ++i) {
+            const auto& sample = samples[i];
+            auto bins = this->get_bins(sample.lat, sample.lon, sample.accuracy_m);
+            sample_bins[i] = bins;
+            counts[size_t(sample.time_index - min_time_index)] +=
+                size_t(bins.lat_last - bins.lat_first + 1) *
+                size_t(bins.lon_last - bins.lon_first + 1);
+        }
+    });
+
+    std::vector<size_t> slice_point_offsets(slice_count + 1);
+    size_t point_count = 0;
+    for (size_t slice_idx = 0; slice_idx < slice_count; ++slice_idx) {
+        slice_point_offsets[slice_idx] = point_count;
+        for (auto& offsets: chunk_offsets) {
+            size_t count = offsets[slice_idx];
+            offsets[slice_idx] = point_count;
+            point_count += count;
+        }
+    }
+    slice_point_offsets[slice_count] = point_count;
+
+    std::unique_ptr<CellPoint[]> cell_points(new CellPoint[point_count]);
+    run_tasks(pool.get(), chunk_count, [&](size_t chunk_idx) {
+        auto& offsets = chunk_offsets[chunk_idx];
+        auto [begin, end] = get_chunk(chunk_idx);
+        for (size_t i = begin; i < end; ++i) {
+            const auto& sample = samples[i];
+            const auto& bins = sample_bins[i];
+            size_t& offset = offsets[size_t(sample.time_index - min_time_index)];
+            for (int32_t lat_bin = bins.lat_first; lat_bin <= bins.lat_last; ++lat_bin) {
+                for (int32_t lon_bin = bins.lon_first; lon_bin <= bins.lon_last; ++lon_bin) {
+                    cell_points[offset++] = CellPoint {
+                        .key = CellKey { sample.time_index, lat_bin, lon_bin },
+                        .lat = sample.lat,
+                        .lon = sample.lon,
+                        .radius_m = sample.accuracy_m,
+                        .user_id = sample.user_id,
+                    };
+                }
+            }
+        }
+    });
+    sample_bins = {};
+    chunk_offsets = {};
+
+    // every task sorts a contiguous range of slices with a similar number of
+    // points and counts the cells in each of them
+    size_t task_count = pool ? 4*chunk_count : 1;
+    auto get_task_slices = [&](size_t task_idx) {
+        auto find_slice = [&](size_t point_idx) {
+            return size_t(std::lower_bound(slice_point_offsets.begin(),
+                slice_point_offsets.end() - 1, point_idx) - slice_point_offsets.begin());
+        };
+        size_t slice_end = task_idx + 1 == task_count ? slice_count
+            : find_slice(point_count * (task_idx + 1) / task_count);
+        return std::make_pair(find_slice(point_count * task_idx / task_count), slice_end);
+    };
+
+    std::vector<size_t> slice_cell_offsets(slice_count + 1, 0);
+    run_tasks(pool.get(), task_count, [&](size_t task_idx) {
+        auto [slice_begin, slice_end] = get_task_slices(task_idx);
+        for (size_t slice_idx = slice_begin; slice_idx < slice_end; ++slice_idx) {
+            CellPoint* begin = &cell_points[0] + slice_point_offsets[slice_idx];
+            CellPoint* end = &cell_points[0] + slice_point_offsets[slice_idx + 1];
+            std::stable_sort(begin, end, [](const auto& p1, const auto& p2) {
+                return p1.key < p2.key;
+            });
+            size_t cell_count = 0;
+            for (CellPoint* point = begin; point != end; ++point) {
+                if (point == begin || !(point[-1].key == point->key)) { ++cell_count; }
             }
+            slice_cell_offsets[slice_idx] = cell_count;
         }
+    });
+
+    size_t cell_count = 0;
+    for (size_t slice_idx = 0; slice_idx < slice_count; ++slice_idx) {
+        size_t count = slice_cell_offsets[slice_idx];
+        slice_cell_offsets[slice_idx] = cell_count;
+        cell_count += count;
+    }
+    slice_cell_offsets[slice_count] = cell_count;
+    if (cell_count >= UINT32_MAX) {
+        throw std::runtime_error("Too many cells in the search structure");
     }
 
-    m_buckets.reserve(m_bucket_count+1);
-    m_points.reserve(point_count);
-    for (auto& bucket: buckets) {
-        std::sort(bucket.begin(), bucket.end(),
-            [&](const UserPoint& p1, const UserPoint& p2)
-        {
-            return p1.time_index < p2.time_index;
-        });
+    m_point_count = point_count;
+    m_point_lats.resize(point_count + SIMD_WIDTH, 0);
+    m_point_lons.resize(point_count + SIMD_WIDTH, 0);
+    m_point_radii.resize(point_count + SIMD_WIDTH, 0.f);
+    m_point_user_ids.resize(point_count + SIMD_WIDTH, 0);
+    m_cell_keys.resize(cell_count);
+    m_cell_offsets.resize(cell_count + 1);
+    m_cell_lat_ranges.resize(cell_count);
+    run_tasks(pool.get(), task_count, [&](size_t task_idx) {
+        auto [slice_begin, slice_end] = get_task_slices(task_idx);
+        size_t cell_idx = 0;
+        size_t next_cell_idx = slice_cell_offsets[slice_begin];
+        size_t point_begin = slice_point_offsets[slice_begin];
+        size_t point_end = slice_point_offsets[slice_end];
+        for (size_t i = point_begin; i < point_end; ++i) {
+            const auto& point = cell_points[i];
+            if (i == point_begin || !(cell_points[i - 1].key == point.key)) {
+                cell_idx = next_cell_idx++;
+                m_cell_keys[cell_idx] = point.key;
+                m_cell_offsets[cell_idx] = i;
+                m_cell_lat_ranges[cell_idx] = std::make_pair(point.lat, point.lat);
+            }
+            auto& lat_range = m_cell_lat_ranges[cell_idx];
+            lat_range.first = std::min(lat_range.first, point.lat);
+            lat_range.second = std::max(lat_range.second, point.lat);
+            m_point_lats[i] = point.lat;
+            m_point_lons[i] = point.lon;
+            m_point_radii[i] = float(point.radius_m);
+            m_point_user_ids[i] = point.user_id;
+        }
+    });
+    m_cell_offsets[cell_count] = point_count;
+    cell_points.reset();
 
-        m_buckets.push_back(m_points.size());
-        m_points.insert(m_points.end(), bucket.begin(), bucket.end());
+    if (m_time_slices) {
+        m_min_time_index = min_time_index;
+        m_slice_offsets = std::move(slice_cell_offsets);
+    } else {
+        this->build_cell_table(pool.get(), task_count);
     }
-    m_buckets.push_back(m_points.size());
 
-    std::cout << "  built search structure of " << point_count << " points "
+    std::cout << "  built search structure of " << m_point_count << " points "
+        "in " << m_cell_keys.size() << " cells "
         "from " << samples.size() << " samples" << std::endl;
 }
 
+void GeoSearch::build_cell_table(ThreadPool* pool, size_t task_count) {
+    // the table is at most half full, so the probe sequences are short
+    size_t table_size = 1;
+    while (table_size < 2*m_cell_keys.size()) { table_size *= 2; }
+    m_cell_table = std::vector<std::atomic<uint32_t>>(table_size);
+    m_cell_table_mask = table_size - 1;
+    run_tasks(pool, task_count, [&](size_t task_idx) {
+        size_t cell_begin = m_cell_keys.size() * task_idx / task_count;
+        size_t cell_end = m_cell_keys.size() * (task_idx + 1) / task_count;
+        for (size_t cell_idx = cell_begin; cell_idx < cell_end; ++cell_idx) {
+            size_t slot = get_hash(m_cell_keys[cell_idx]) & m_cell_table_mask;
+            uint32_t empty = EMPTY_SLOT;
+            while (!m_cell_table[slot].compare_exchange_strong(empty,
+                uint32_t(cell_idx + 1), std::memory_order_relaxed))
+            {
+                empty = EMPTY_SLOT;
+                slot = (slot + 1) & m_cell_table_mask;
+            }
+        }
+    });
+}
+
+// Returns the index of the cell with the given key, or m_cell_keys.size() if
+// the cell is empty
+size_t GeoSearch::find_cell(const CellKey& key) const {
+    size_t slot = get_hash(key) & m_cell_table_mask;
+    for (;;) {
+        uint32_t entry = m_cell_table[slot].load(std::memory_order_relaxed);
+        if (entry == EMPTY_SLOT) { return m_cell_keys.size(); }
+        if (m_cell_keys[entry - 1] == key) { return entry - 1; }
+        slot = (slot + 1) & m_cell_table_mask;
+    }
+}
+
 void GeoSearch::find_users_in_bin(int32_t lat, int32_t lon, uint32_t radius_m,
     int32_t time_index, int32_t lat_bin, int32_t lon_bin,
-    std::unordered_set<uint32_t>& out_user_ids) const
+    std::vector<uint32_t>& out_user_ids) const
 {
-    uint32_t hash = this->get_hash(lat_bin, lon_bin, time_index);
-    size_t bucket_idx = hash % m_bucket_count;
-    auto [begin, end] = this->find_time_range_in_bucket(bucket_idx, time_index);
-    for (size_t i = begin; i < end; ++i) {
-        const auto& point = m_points.at(i);
-        assert(point.time_index == time_index);
-        m_point_hit_count.fetch_add(1);
-        if (point.hash != hash) { continue; }
+    m_cell_probe_count.fetch_add(1);
+    size_t cell_idx = this->find_cell(CellKey { time_index, lat_bin, lon_bin });
+    if (cell_idx == m_cell_keys.size()) { return; }
+    this->find_users_in_cell(lat, lon, radius_m, cell_idx, out_user_ids);
+}
 
-        m_point_test_count.fetch_add(1);
-        double distance_pow2 = pow2_geo_distance_fast_m(
-            point.lat, point.lon, lat, lon);
-        double max_distance = (double)radius_m + (double)point.radius_m;
-        if (distance_pow2 > max_distance*max_distance) { continue; }
+void GeoSearch::find_users_in_slice(int32_t lat, int32_t lon, uint32_t radius_m,
+    int32_t time_index, const LatLonBins& bins,
+    std::vector<uint32_t>& out_user_ids) const
+{
+    if (time_index < m_min_time_index) { return; }
+    size_t slice_idx = size_t(time_index - m_min_time_index);
+    if (slice_idx + 1 >= m_slice_offsets.size()) { return; }
 
-        m_point_pass_count.fetch_add(1);
-        out_user_ids.insert(point.user_id);
+    // the cells of a slice are sorted by lat_bin and lon_bin, so the cells of
+    // every row of bins are contiguous
+    auto slice_begin = m_cell_keys.begin() + ptrdiff_t(m_slice_offsets[slice_idx]);
+    auto slice_end = m_cell_keys.begin() + ptrdiff_t(m_slice_offsets[slice_idx + 1]);
+    for (int32_t i = bins.lat_first; i <= bins.lat_last; ++i) {
+        m_cell_probe_count.fetch_add(1);
+        auto cell_it = std::lower_bound(slice_begin, slice_end,
+            CellKey { time_index, i, bins.lon_first });
+        for (; cell_it != slice_end && cell_it->lat_bin == i
+            && cell_it->lon_bin <= bins.lon_last; ++cell_it)
+        {
+            size_t cell_idx = size_t(cell_it - m_cell_keys.begin());
+            this->find_users_in_cell(lat, lon, radius_m, cell_idx, out_user_ids);
+        }
+        slice_begin = cell_it;
     }
-    m_bin_hit_count.fetch_add(1);
 }
 
-std::pair<size_t,size_t> GeoSearch::find_time_range_in_bucket(
-    size_t bucket_idx, int32_t time_index) const
+void GeoSearch::find_users_in_cell(int32_t lat, int32_t lon, uint32_t radius_m,
+    size_t cell_idx, std::vector<uint32_t>& out_user_ids) const
 {
-    size_t bucket_begin = m_buckets.at(bucket_idx);
-    size_t bucket_end = m_buckets.at(bucket_idx + 1);
-    while (bucket_begin < bucket_end) {
-        size_t bucket_mid = bucket_begin + (bucket_end - bucket_begin) / 2;
-        int32_t mid_time_index = m_points.at(bucket_mid).time_index;
-        if (mid_time_index < time_index) {
-            bucket_begin = bucket_mid + 1;
-        } else if (mid_time_index > time_index) {
-            bucket_end = bucket_mid;
-        } else {
-            size_t begin = bucket_mid;
-            for (; begin > bucket_begin 
-                && m_points.at(begin-1).time_index == time_index; --begin) {}
-            size_t end = bucket_mid + 1;
-            for (; end + 1 < bucket_end 
-                && m_points.at(end+1).time_index == time_index; ++end) {}
-            return {begin, end};
-        }
-    }
-    return {0, 0};
+    m_cell_hit_count.fetch_add(1);
+
+    // pow2_geo_distance_fast_m() takes the cosine of the mean latitude of the
+    // two points, which is bounded by the latitudes of the cell
+    auto [min_lat, max_lat] = m_cell_lat_ranges[cell_idx];
+    int32_t mean_lat_first = (min_lat + lat)/2;
+    int32_t mean_lat_last = (max_lat + lat)/2;
+    double cos_first = std::cos(double(mean_lat_first) * DEG_E7_TO_RAD);
+    double cos_last = std::cos(double(mean_lat_last) * DEG_E7_TO_RAD);
+    double cos_lo = std::min(cos_first, cos_last);
+    double cos_hi = mean_lat_first <= 0 && mean_lat_last >= 0
+        ? 1.0 : std::max(cos_first, cos_last);
+
+    CircleFilter filter {
+        .lat = lat,
+        .lon = lon,
+        .radius_m = radius_m,
+        .lat_coef = float(DEG_E7_TO_M*DEG_E7_TO_M),
+        .lon_coef_lo = float(DEG_E7_TO_M*DEG_E7_TO_M*cos_lo*cos_lo),
+        .lon_coef_hi = float(DEG_E7_TO_M*DEG_E7_TO_M*cos_hi*cos_hi),
+    };
+
+    size_t begin = m_cell_offsets[cell_idx];
+    size_t count = m_cell_offsets[cell_idx + 1] - begin;
+    auto filter_points = filter_points_scalar;
+#ifdef __x86_64__
+    if (m_use_avx2) { filter_points = filter_points_avx2; }
+#endif
+    uint64_t pass_count = filter_points(filter,
+        &m_point_lats[begin], &m_point_lons[begin], &m_point_radii[begin],
+        &m_point_user_ids[begin], count, out_user_ids);
+
+    m_point_test_count.fetch_add(count);
+    m_point_pass_count.fetch_add(pass_count);
 }
 
-void GeoSearch::find_users_within_circle(int32_t lat, int32_t lon,
-    uint32_t radius_m, int32_t time_index,
-    std::unordered_set<uint32_t>& out_user_ids) const
+void GeoSearch::find_users_in_bins(int32_t lat, int32_t lon, uint32_t radius_m,
+    int32_t time_index, const LatLonBins& bins,
+    std::vector<uint32_t>& out_user_ids) const
 {
-    auto bins = this->get_bins(lat, lon, radius_m);
+    if (m_time_slices) {
+        this->find_users_in_slice(lat, lon, radius_m, time_index, bins, out_user_ids);
+        return;
+    }
     for (int32_t i = bins.lat_first; i <= bins.lat_last; ++i) {
         for (int32_t j = bins.lon_first; j <= bins.lon_last; ++j) {
             this->find_users_in_bin(lat, lon, radius_m, time_index,
                 i, j, out_user_ids);
         }
     }
-    m_query_count.fetch_add(1);
+}
+
+std::vector<uint32_t> GeoSearch::find_user_ids_along_trajectory(
+    ArrayView<const GeoSample> samples) const
+{
+    std::vector<uint32_t> user_ids;
+    size_t distinct_count = 0;
+    LatLonBins bins {};
+    const GeoSample* prev_sample = nullptr;
+    for (const auto& sample: samples) {
+        assert(!prev_sample || prev_sample->time_index <= sample.time_index);
+        // consecutive samples of a stationary user cover the same bins
+        if (!prev_sample || prev_sample->lat != sample.lat
+            || prev_sample->lon != sample.lon
+            || prev_sample->accuracy_m != sample.accuracy_m)
+        {
+            bins = this->get_bins(sample.lat, sample.lon, sample.accuracy_m);
+        }
+        prev_sample = &sample;
+
+        // a point is found once for every cell that it overlaps, and a user is
+        // found in many samples, so we compact the ids whenever they double to
+        // keep the vector proportional to the number of distinct users
+        this->find_users_in_bins(sample.lat, sample.lon, sample.accuracy_m,
+            sample.time_index, bins, user_ids);
+        if (user_ids.size() > 2*distinct_count + 64) {
+            std::sort(user_ids.begin(), user_ids.end());
+            user_ids.erase(std::unique(user_ids.begin(), user_ids.end()), user_ids.end());
+            distinct_count = user_ids.size();
+        }
+    }
+    m_query_count.fetch_add(samples.size());
+
+    std::sort(user_ids.begin(), user_ids.end());
+    user_ids.erase(std::unique(user_ids.begin(), user_ids.end()), user_ids.end());
+    return user_ids;
 }
 
 void GeoSearch::close() {
     std::cout << "Search structure stats:" << std::endl
         << "  queries: " << m_query_count.load() << std::endl
-        << "  bin hits: " << m_bin_hit_count.load() << std::endl
-        << "  point hits: " << m_point_hit_count.load() << std::endl
+        << "  cell probes: " << m_cell_probe_count.load() << std::endl
+        << "  cell hits: " << m_cell_hit_count.load() << std::endl
         << "  point tests: " << m_point_test_count.load() << std::endl
         << "  point passes: " << m_point_pass_count.load() << std::endl;
 }
@@ -1,17 +1,39 @@
 #pragma once
 #include <atomic>
-#include <unordered_set>
+#include <vector>
 #include "geosick/config.hpp"
 #include "geosick/sampler.hpp"
 
 namespace geosick {
 
+class ThreadPool;
+
+// Index of samples of sick users by cells of a grid in space and time. Every
+// sample is stored in all cells that its accuracy circle overlaps. The points
+// are sorted by cell, so the points of each cell form a contiguous range, and
+// the cells are found either through an open-addressing hash table, or through
+// a dense array of time slices, which are then searched by lat_bin and lon_bin.
 class GeoSearch {
-    struct UserPoint {
+    struct CellKey {
         int32_t time_index;
+        int32_t lat_bin;
+        int32_t lon_bin;
+
+        bool operator==(const CellKey& other) const {
+            return time_index == other.time_index
+                && lat_bin == other.lat_bin && lon_bin == other.lon_bin;
+        }
+        bool operator<(const CellKey& other) const {
+            if (time_index != other.time_index) { return time_index < other.time_index; }
+            if (lat_bin != other.lat_bin) { return lat_bin < other.lat_bin; }
+            return lon_bin < other.lon_bin;
+        }
+    };
+
+    struct CellPoint {
+        CellKey key;
         int32_t lat, lon;
-        uint32_t hash;
-        uint32_t radius_m;
+        uint16_t radius_m;
         uint32_t user_id;
     };
 
@@ -22,31 +44,64 @@ class GeoSearch {
         int32_t lon_last;
     };
 
+    // sentinel in m_cell_table
+    static constexpr uint32_t EMPTY_SLOT = 0;
+
     int32_t m_lat_delta;
     int32_t m_lon_delta;
-    size_t m_bucket_count;
-    std::vector<UserPoint> m_points;
-    std::vector<size_t> m_buckets;
+    bool m_use_avx2;
+    // Points are stored as a structure of arrays, padded at the end so that
+    // the distance filter can always read full SIMD vectors. The radius is a
+    // float, which represents every uint16_t accuracy exactly.
+    size_t m_point_count = 0;
+    std::vector<int32_t> m_point_lats;
+    std::vector<int32_t> m_point_lons;
+    std::vector<float> m_point_radii;
+    std::vector<uint32_t> m_point_user_ids;
+    // points of cell i are [m_cell_offsets[i], m_cell_offsets[i+1]), and their
+    // latitudes are within m_cell_lat_ranges[i]
+    std::vector<CellKey> m_cell_keys;
+    std::vector<size_t> m_cell_offsets;
+    std::vector<std::pair<int32_t, int32_t>> m_cell_lat_ranges;
+    // open-addressing table of indices into m_cell_keys plus one; it is
+    // atomic only so that it can be filled in parallel
+    std::vector<std::atomic<uint32_t>> m_cell_table;
+    size_t m_cell_table_mask = 0;
+    // with time slices, the cells with time index m_min_time_index + i are
+    // [m_slice_offsets[i], m_slice_offsets[i+1])
+    bool m_time_slices;
+    int32_t m_min_time_index = 0;
+    std::vector<size_t> m_slice_offsets;
 
     mutable std::atomic<uint64_t> m_query_count { 0 };
-    mutable std::atomic<uint64_t> m_bin_hit_count { 0 };
-    mutable std::atomic<uint64_t> m_point_hit_count { 0 };
+    mutable std::atomic<uint64_t> m_cell_probe_count { 0 };
+    mutable std::atomic<uint64_t> m_cell_hit_count { 0 };
     mutable std::atomic<uint64_t> m_point_test_count { 0 };
     mutable std::atomic<uint64_t> m_point_pass_count { 0 };
 
     LatLonBins get_bins(int32_t lat, int32_t lon, uint32_t radius) const;
-    uint32_t get_hash(int32_t lat_bin, int32_t lon_bin, int32_t time_index) const;
+    static uint32_t get_hash(const CellKey& key);
+    void build_cell_table(ThreadPool* pool, size_t task_count);
+    size_t find_cell(const CellKey& key) const;
 
     void find_users_in_bin(int32_t lat, int32_t lon, uint32_t radius_m,
         int32_t time_index, int32_t lat_bin, int32_t lon_bin,
-        std::unordered_set<uint32_t>& out_user_ids) const;
-    std::pair<size_t, size_t> find_time_range_in_bucket(
-        size_t bucket_idx, int32_t time_index) const;
+        std::vector<uint32_t>& out_user_ids) const;
+    void find_users_in_slice(int32_t lat, int32_t lon, uint32_t radius_m,
+        int32_t time_index, const LatLonBins& bins,
+        std::vector<uint32_t>& out_user_ids) const;
+    void find_users_in_cell(int32_t lat, int32_t lon, uint32_t radius_m,
+        size_t cell_idx, std::vector<uint32_t>& out_user_ids) const;
+    void find_users_in_bins(int32_t lat, int32_t lon, uint32_t radius_m,
+        int32_t time_index, const LatLonBins& bins,
+        std::vector<uint32_t>& out_user_ids) const;
 public:
     explicit GeoSearch(const Config& cfg, ArrayView<const GeoSample> samples);
 
-    void find_users_within_circle(int32_t lat, int32_t lon, uint32_t radius_m,
-        int32_t time_index, std::unordered_set<uint32_t>& out_user_ids) const;
+    // Finds the sick users that overlap any of the samples, which must be
+    // sorted by time_index. Returns the distinct user ids in ascending order.
+    std::vector<uint32_t> find_user_ids_along_trajectory(
+        ArrayView<const GeoSample> samples) const;
 
     void close();
 };
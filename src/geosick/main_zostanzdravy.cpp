@@ -1,13 +1,17 @@
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <nlohmann/json.hpp>
 #include "geosick/file_writer.hpp"
 #include "geosick/geo_distance.hpp"
 #include "geosick/geo_search.hpp"
 #include "geosick/mysql_db.hpp"
+#include "geosick/radix_sort.hpp"
 #include "geosick/read_process.hpp"
 #include "geosick/sampler.hpp"
 #include "geosick/search_process.hpp"
+#include "geosick/snapshot.hpp"
+#include "geosick/thread_pool.hpp"
 
 namespace geosick {
 
@@ -34,20 +38,41 @@ static Config config_from_json(nlohmann::json& doc) {
     cfg.mysql.user = doc.at(p("/mysql/user")).get<std::string>();
     cfg.mysql.password = doc.at(p("/mysql/password")).get<std::string>();
     cfg.mysql.ssl_mode = doc.value<std::string>(p("/mysql/ssl_mode"), "PREFERRED");
+    cfg.mysql.bulk_batch_size = doc.value<uint32_t>(p("/mysql/bulk_batch_size"), 1000);
+    cfg.mysql.dedup_mode = doc.value<std::string>(p("/mysql/dedup_mode"), "client");
+    cfg.mysql.filter_rows = doc.value<bool>(p("/mysql/filter_rows"), false);
+    cfg.mysql.read_connections = doc.value<uint32_t>(p("/mysql/read_connections"), 1);
+    cfg.mysql.parse_threads = doc.value<uint32_t>(p("/mysql/parse_threads"), 0);
+    cfg.mysql.binary_protocol = doc.value<bool>(p("/mysql/binary_protocol"), false);
 
-    cfg.search.bucket_count = doc.value<uint32_t>(p("/search/bucket_count"), 1000);
     cfg.search.bin_delta_m = doc.value<double>(p("/search/bin_delta_m"), 200.0);
+    cfg.search.partition_count = doc.value<uint32_t>(p("/search/partition_count"), 1);
+    cfg.search.thread_count = doc.value<uint32_t>(p("/search/thread_count"), 1);
+    cfg.search.index_layout = doc.value<std::string>(p("/search/index_layout"), "cells");
+    cfg.search.build_threads = doc.value<uint32_t>(p("/search/build_threads"), 1);
 
     cfg.notify.use_json = doc.value<bool>(p("/notify/use_json"), true);
     cfg.notify.json_min_score = doc.value<double>(p("/notify/json_min_score"), 0.001);
     cfg.notify.json_select = doc.value<double>(p("/notify/json_select"), 0.1);
     cfg.notify.use_mysql = doc.value<bool>(p("/notify/use_mysql"), false);
     cfg.notify.mysql_min_score = doc.value<double>(p("/notify/mysql_min_score"), 0.05);
+    cfg.notify.mysql_streaming = doc.value<bool>(p("/notify/mysql_streaming"), false);
+    cfg.notify.mysql_queue_batches = doc.value<uint32_t>(p("/notify/mysql_queue_batches"), 16);
 
     cfg.range_days = doc.value<uint32_t>(p("/range_days"), 14);
     cfg.period_s = doc.value<uint32_t>(p("/period_s"), 30);
     cfg.temp_dir = doc.at(p("/temp_dir")).get<std::string>();
+    cfg.snapshot_dir = doc.value<std::string>(p("/snapshot_dir"), "");
+    cfg.compact_temp_files = doc.value<bool>(p("/compact_temp_files"), false);
+    cfg.sort_threads = doc.value<uint32_t>(p("/sort_threads"), 1);
+    cfg.ingest_strategy = doc.value<std::string>(p("/ingest_strategy"), "sort");
+    cfg.partition_bucket_count = doc.value<uint32_t>(p("/partition_bucket_count"), 64);
+    cfg.merge_threads = doc.value<uint32_t>(p("/merge_threads"), 1);
+    cfg.merge_fan_in = doc.value<uint32_t>(p("/merge_fan_in"), 5);
+    cfg.merge_bandwidth_mb_s = doc.value<double>(p("/merge_bandwidth_mb_s"), 0.0);
     cfg.row_buffer_size = doc.value<uint32_t>(p("/row_buffer_size"), 40000000);
+    cfg.memory_budget_bytes = doc.value<uint64_t>(p("/memory_budget_bytes"), 0);
+    cfg.overlap_build = doc.value<bool>(p("/overlap_build"), false);
     return cfg;
 }
 
@@ -96,16 +121,6 @@ static void main(int argc, char** argv) {
     std::filesystem::path temp_dir = cfg.temp_dir;
     MysqlDb mysql(cfg);
 
-    std::cout << "Reading rows..." << std::endl;
-    Stopwatch read_sw;
-    auto user_ids = mysql.read_user_ids();
-    ReadProcess read_proc(&user_ids.sick, &user_ids.query, temp_dir, cfg.row_buffer_size);
-    {
-        auto row_reader = mysql.read_rows();
-        read_proc.process(*row_reader);
-    }
-    std::cout << "  reading took " << read_sw.get_s() << " s" << std::endl;
-
     int32_t mysql_time = mysql.read_now_timestamp();
     int32_t end_time = mysql_time;
     int32_t begin_time = end_time - 24*60*60 * (int32_t)cfg.range_days;
@@ -117,24 +132,154 @@ static void main(int argc, char** argv) {
         << "  period: " << period << std::endl;
     Sampler sampler(begin_time, end_time, period);
 
+    std::cout << "Reading rows..." << std::endl;
+    Stopwatch read_sw;
+    auto user_ids = mysql.read_user_ids();
+    uint32_t read_connections = std::max(cfg.mysql.read_connections, 1u);
+    size_t row_buffer_size = std::max(cfg.row_buffer_size / read_connections, 1u);
+    // with overlap_build, the rows of sick users are read first and the search
+    // structure is built while the rows of query users are read
+    bool overlap_build = cfg.overlap_build && cfg.snapshot_dir.empty();
+    // the second query of overlap_build also returns rows of sick users, which
+    // are already loaded, so ReadProcess only keeps the rows of query users
+    std::unordered_set<uint32_t> no_user_ids;
+    ReadProcess read_proc(&cfg, overlap_build ? &no_user_ids : &user_ids.sick,
+        &user_ids.query, temp_dir, row_buffer_size);
+    std::unique_ptr<Snapshot> snapshot;
+    if (!cfg.snapshot_dir.empty()) {
+        snapshot = std::make_unique<Snapshot>(cfg.snapshot_dir, row_buffer_size,
+            cfg.sort_threads);
+    }
+
+    SickMap sick_map;
+    std::unique_ptr<GeoSearch> search;
+    std::future<double> build_future;
+    if (overlap_build) {
+        MysqlDb::RowFilter sick_filter;
+        sick_filter.min_timestamp = sampler.get_min_row_timestamp();
+        // the query lists the sick users from read_user_ids(), so that users
+        // whose status changes in the meantime are still treated as sick
+        sick_filter.user_ids = &user_ids.sick;
+        std::vector<GeoRow> sick_rows;
+        {
+            auto row_reader = mysql.read_rows(sick_filter);
+            std::vector<GeoRow> batch(ROW_BATCH_SIZE);
+            while (size_t batch_size = row_reader->read_batch(make_view(batch))) {
+                sick_rows.insert(sick_rows.end(), batch.begin(),
+                    batch.begin() + (ptrdiff_t)batch_size);
+            }
+        }
+        std::cout << "  loaded " << sick_rows.size() << " sick rows" << std::endl;
+        radix_sort_rows(sick_rows, cfg.sort_threads);
+
+        build_future = std::async(std::launch::async,
+            [&, sick_rows = std::move(sick_rows)]() mutable
+        {
+            Stopwatch build_sw;
+            sick_map = read_sick_map(sampler, std::move(sick_rows));
+            search = std::make_unique<GeoSearch>(cfg, make_view(sick_map.samples));
+            return build_sw.get_s();
+        });
+    }
+
+    {
+        MysqlDb::RowFilter row_filter;
+        if (snapshot) {
+            // the snapshot stores positions of all users, because the status
+            // of users may change between runs
+            int32_t min_timestamp = sampler.get_min_row_timestamp();
+            row_filter.min_timestamp = std::max(min_timestamp,
+                snapshot->get_high_water_mark().value_or(min_timestamp));
+            row_filter.max_timestamp = end_time;
+        } else if (cfg.mysql.filter_rows) {
+            // the rows are not filtered by status on the server, because the
+            // status of users may change after read_user_ids(); ReadProcess
+            // keeps only the rows of the users loaded there
+            row_filter.min_timestamp = sampler.get_min_row_timestamp();
+        }
+
+        auto process_rows = [&](GeoRowReader& row_reader) {
+            if (snapshot) {
+                snapshot->add_delta(row_reader);
+            } else {
+                read_proc.process(row_reader);
+            }
+        };
+
+        if (read_connections == 1) {
+            auto row_reader = mysql.read_rows(row_filter);
+            process_rows(*row_reader);
+        } else {
+            // every connection reads a disjoint class of client_id modulo the
+            // number of connections
+            std::vector<std::future<void>> read_futures;
+            for (uint32_t i = 0; i < read_connections; ++i) {
+                read_futures.push_back(std::async(std::launch::async,
+                    [&cfg, &process_rows, row_filter, read_connections, i]() mutable
+                {
+                    MysqlDb conn_mysql(cfg);
+                    row_filter.client_modulo = read_connections;
+                    row_filter.client_class = i;
+                    auto row_reader = conn_mysql.read_rows(row_filter);
+                    process_rows(*row_reader);
+                }));
+            }
+            for (auto& future: read_futures) {
+                future.get();
+            }
+        }
+
+        if (snapshot) {
+            snapshot->commit(end_time, sampler.get_min_row_timestamp(), read_proc);
+        }
+    }
+    std::cout << "  reading took " << read_sw.get_s() << " s" << std::endl;
+
     std::cout << "Building the search structure..." << std::endl;
     Stopwatch build_sw;
-    auto sick_map = read_sick_map(sampler, read_proc.read_sick_rows());
-    GeoSearch search(cfg, make_view(sick_map.samples));
-    std::cout << "  building took " << build_sw.get_s() << " s" << std::endl;
+    if (overlap_build) {
+        double build_s = build_future.get();
+        std::cout << "  building took " << build_s << " s, waited "
+            << build_sw.get_s() << " s after reading" << std::endl;
+    } else {
+        sick_map = read_sick_map(sampler, read_proc.read_sick_rows());
+        search = std::make_unique<GeoSearch>(cfg, make_view(sick_map.samples));
+        std::cout << "  building took " << build_sw.get_s() << " s" << std::endl;
+    }
 
     std::cout << "Searching for matches..." << std::endl;
     Stopwatch search_sw;
     NotifyProcess notify_proc(&cfg, &sampler, &mysql,
         temp_dir / "matches.json", temp_dir / "selected_matches.json.bz2");
-    SearchProcess search_proc(&cfg, &sampler, &search, &sick_map, &notify_proc);
-    auto reader = read_proc.read_query_rows();
-    while (auto row = reader->read()) {
-        search_proc.process_query_row(*row);
+    std::unique_ptr<ThreadPool> search_pool;
+    if (cfg.search.thread_count > 1) {
+        search_pool = std::make_unique<ThreadPool>(cfg.search.thread_count);
+    }
+    auto readers = read_proc.read_query_rows(std::max(cfg.search.partition_count, 1u));
+    std::cout << "  split query rows into " << readers.size() << " partitions" << std::endl;
+    std::vector<std::unique_ptr<SearchProcess>> search_procs;
+    std::vector<std::future<void>> search_futures;
+    for (auto& reader: readers) {
+        search_procs.push_back(std::make_unique<SearchProcess>(
+            &cfg, &sampler, search.get(), &sick_map, notify_proc.add_shard(), search_pool.get()));
+        search_futures.push_back(std::async(std::launch::async,
+            [&search_proc = *search_procs.back(), &reader = *reader]
+        {
+            std::vector<GeoRow> batch(ROW_BATCH_SIZE);
+            while (size_t batch_size = reader.read_batch(make_view(batch))) {
+                search_proc.process_query_rows(
+                    make_view(batch.data(), batch.data() + batch_size));
+            }
+        }));
+    }
+    for (auto& future: search_futures) {
+        future.get();
     }
     std::cout << "  searching took " << search_sw.get_s() << " s" << std::endl;
-    search_proc.close();
-    search.close();
+    for (auto& search_proc: search_procs) {
+        search_proc->close();
+    }
+    search->close();
     notify_proc.close();
 
     std::cout << "Done in " << all_sw.get_s() << " s" << std::endl;
@@ -0,0 +1,95 @@
+#include <chrono>
+#include <iostream>
+#include "geosick/match_uploader.hpp"
+
+namespace geosick {
+
+MatchUploader::MatchUploader(MysqlDb* mysql, size_t max_queued_batches):
+    m_mysql(mysql),
+    m_max_queued_batches(std::max(max_queued_batches, size_t(1)))
+{
+    m_thread = std::thread(&MatchUploader::run, this);
+}
+
+MatchUploader::~MatchUploader() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+    }
+    m_pop_cond.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void MatchUploader::run() {
+    try {
+        auto start_time = std::chrono::steady_clock::now();
+        m_mysql->begin_matches();
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_busy_s += std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start_time).count();
+
+        for (;;) {
+            m_pop_cond.wait(lock, [&] { return m_closed || !m_queue.empty(); });
+            if (m_queue.empty()) { break; }
+
+            auto batch = std::move(m_queue.front());
+            m_queue.pop_front();
+            lock.unlock();
+            m_push_cond.notify_all();
+
+            start_time = std::chrono::steady_clock::now();
+            uint64_t write_count = m_mysql->write_match_batch(make_view(batch));
+            double busy_s = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start_time).count();
+
+            lock.lock();
+            m_match_count += batch.size();
+            m_write_count += write_count;
+            m_busy_s += busy_s;
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_error = std::current_exception();
+        m_queue.clear();
+    }
+    m_push_cond.notify_all();
+}
+
+void MatchUploader::push(std::vector<MysqlDb::Match> batch) {
+    if (batch.empty()) { return; }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_push_cond.wait(lock, [&] {
+        return m_error || m_queue.size() < m_max_queued_batches;
+    });
+    if (m_error) { std::rethrow_exception(m_error); }
+    if (m_closed) {
+        throw std::logic_error("Cannot push matches to a closed MatchUploader");
+    }
+    m_queue.push_back(std::move(batch));
+    lock.unlock();
+    m_pop_cond.notify_one();
+}
+
+uint64_t MatchUploader::close() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+    }
+    m_pop_cond.notify_all();
+    m_thread.join();
+    if (m_error) { std::rethrow_exception(m_error); }
+
+    auto start_time = std::chrono::steady_clock::now();
+    m_mysql->commit_matches();
+    m_busy_s += std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start_time).count();
+
+    std::cout << "  streamed " << m_write_count << " matches to mysql, "
+        << "busy for " << m_busy_s << " s (" << double(m_match_count) / std::max(m_busy_s, 1e-9)
+        << " matches/s)" << std::endl;
+    return m_write_count;
+}
+
+}
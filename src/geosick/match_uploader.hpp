@@ -0,0 +1,43 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "geosick/mysql_db.hpp"
+
+namespace geosick {
+
+// Uploads batches of matches to MySQL on a background thread while the search
+// is still running. The queue of batches is bounded, so push() blocks when
+// the database cannot keep up.
+class MatchUploader {
+    MysqlDb* m_mysql;
+    size_t m_max_queued_batches;
+
+    std::mutex m_mutex;
+    std::condition_variable m_push_cond;
+    std::condition_variable m_pop_cond;
+    std::deque<std::vector<MysqlDb::Match>> m_queue;
+    bool m_closed = false;
+    std::exception_ptr m_error;
+    uint64_t m_match_count = 0;
+    uint64_t m_write_count = 0;
+    double m_busy_s = 0.0;
+    std::thread m_thread;
+
+    void run();
+public:
+    MatchUploader(MysqlDb* mysql, size_t max_queued_batches);
+    ~MatchUploader();
+    MatchUploader(const MatchUploader&) = delete;
+    MatchUploader& operator=(const MatchUploader&) = delete;
+
+    void push(std::vector<MysqlDb::Match> batch);
+    // Waits until all batches are uploaded, commits them and returns the
+    // number of written matches
+    uint64_t close();
+};
+
+}
@@ -1,57 +1,133 @@
 #pragma once
-#include <algorithm>
+#include <memory>
 #include <vector>
 #include "geosick/geo_row_reader.hpp"
 
 namespace geosick {
 
-template<class Compare>
+// Merges readers that are sorted by get_row_key() using a tournament (loser)
+// tree, which needs a single comparison per tree level for every output row.
+// Rows of readers that support views are merged straight from their memory.
 class MergeReader final: public GeoRowReader {
-    Compare m_compare;
-    
-    struct HeapEntry {
-        GeoRow row;
+    static constexpr uint64_t EXHAUSTED_KEY = UINT64_MAX;
+
+    struct Input {
         std::unique_ptr<GeoRowReader> reader;
+        bool use_views = false;
+        std::vector<GeoRow> buffer;
+        ArrayView<const GeoRow> rows { nullptr, nullptr };
+        size_t pos = 0;
     };
-    std::vector<HeapEntry> m_heap;
-
-    void advance() {
-        if (auto row = m_heap.back().reader->read()) {
-            m_heap.back().row = *row;
-            std::push_heap(m_heap.begin(), m_heap.end(),
-                [this](const HeapEntry& e1, const HeapEntry& e2) {
-                    return m_compare(e2.row, e1.row);
-                });
+    std::vector<Input> m_inputs;
+    std::vector<uint64_t> m_keys;
+    std::vector<size_t> m_losers;
+    size_t m_leaf_count = 0;
+    size_t m_winner = 0;
+    bool m_built = false;
+
+    static bool refill(Input& input) {
+        if (input.use_views) {
+            input.rows = input.reader->read_view(ROW_BATCH_SIZE);
         } else {
-            m_heap.pop_back();
+            input.buffer.resize(ROW_BATCH_SIZE);
+            size_t count = input.reader->read_batch(make_view(input.buffer));
+            input.buffer.resize(count);
+            input.rows = make_view(input.buffer.data(), input.buffer.data() + count);
+        }
+        input.pos = 0;
+        if (input.rows.size() == 0) {
+            // the view may point into the reader, so it must not outlive it
+            input.rows = { nullptr, nullptr };
+            input.reader.reset();
+            input.buffer.shrink_to_fit();
+            return false;
         }
+        return true;
+    }
+
+    void build() {
+        m_leaf_count = 1;
+        while (m_leaf_count < m_inputs.size()) { m_leaf_count *= 2; }
+
+        m_keys.assign(m_leaf_count, EXHAUSTED_KEY);
+        for (size_t i = 0; i < m_inputs.size(); ++i) {
+            const Input& input = m_inputs[i];
+            if (input.pos < input.rows.size()) {
+                m_keys[i] = get_row_key(input.rows[input.pos]);
+            }
+        }
+
+        std::vector<size_t> winners(2*m_leaf_count);
+        m_losers.assign(m_leaf_count, 0);
+        for (size_t i = 0; i < m_leaf_count; ++i) {
+            winners[m_leaf_count + i] = i;
+        }
+        for (size_t node = m_leaf_count - 1; node > 0; --node) {
+            size_t left = winners[2*node];
+            size_t right = winners[2*node + 1];
+            if (m_keys[right] < m_keys[left]) {
+                winners[node] = right;
+                m_losers[node] = left;
+            } else {
+                winners[node] = left;
+                m_losers[node] = right;
+            }
+        }
+        m_winner = winners[1];
+        m_built = true;
+    }
+
+    void replay() {
+        size_t winner = m_winner;
+        uint64_t key = m_keys[winner];
+        for (size_t node = (m_leaf_count + winner) / 2; node > 0; node /= 2) {
+            size_t loser = m_losers[node];
+            if (m_keys[loser] < key) {
+                m_losers[node] = winner;
+                winner = loser;
+                key = m_keys[loser];
+            }
+        }
+        m_winner = winner;
     }
 
 public:
-    explicit MergeReader(Compare compare): m_compare(std::move(compare)) {}
+    MergeReader() {}
 
     void add_reader(std::unique_ptr<GeoRowReader> reader) {
-        m_heap.emplace_back();
-        m_heap.back().reader = std::move(reader);
-        this->advance();
+        m_inputs.emplace_back();
+        m_inputs.back().use_views = reader->has_views();
+        m_inputs.back().reader = std::move(reader);
+        refill(m_inputs.back());
+        m_built = false;
     }
 
     size_t get_reader_count() const {
-        return m_heap.size();
+        size_t count = 0;
+        for (const auto& input: m_inputs) {
+            if (input.reader) { ++count; }
+        }
+        return count;
     }
 
-    virtual std::optional<GeoRow> read() override {
-        if (m_heap.empty()) {
-            return {};
-        }
+    virtual size_t read_batch(ArrayView<GeoRow> out) override {
+        if (!m_built) { this->build(); }
 
-        GeoRow row = m_heap.front().row;
-        std::pop_heap(m_heap.begin(), m_heap.end(),
-            [this](const HeapEntry& e1, const HeapEntry& e2) {
-                return m_compare(e2.row, e1.row);
-            });
-        this->advance();
-        return row;
+        size_t count = 0;
+        while (count < out.size()) {
+            size_t winner = m_winner;
+            if (m_keys[winner] == EXHAUSTED_KEY) { break; }
+
+            Input& input = m_inputs[winner];
+            out[count++] = input.rows[input.pos++];
+            if (input.pos < input.rows.size() || refill(input)) {
+                m_keys[winner] = get_row_key(input.rows[input.pos]);
+            } else {
+                m_keys[winner] = EXHAUSTED_KEY;
+            }
+            this->replay();
+        }
+        return count;
     }
 };
 
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "geosick/mmap_file_reader.hpp"
+
+namespace geosick {
+
+// Number of bytes ahead of the cursor that we ask the kernel to prefetch
+static constexpr size_t PREFETCH_BYTES = 8 << 20;
+// Number of bytes behind the cursor that are released from memory at once
+static constexpr size_t DROP_BYTES = 8 << 20;
+
+static size_t page_size() {
+    static const size_t size = (size_t)sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+MmapFileReader::MmapFileReader(const std::filesystem::path& path) {
+    m_fd = ::open(path.c_str(), O_RDONLY);
+    if (m_fd < 0) {
+        throw std::runtime_error(
+            "Could not open file for reading: " + path.string());
+    }
+
+    struct stat st;
+    if (::fstat(m_fd, &st) != 0) {
+        this->close();
+        throw std::runtime_error("Could not stat file: " + path.string());
+    }
+    m_map_size = (size_t)st.st_size;
+    m_row_count = m_map_size / sizeof(GeoRow);
+    m_end = m_row_count;
+    if (m_map_size == 0) { return; }
+
+    m_map = ::mmap(nullptr, m_map_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (m_map == MAP_FAILED) {
+        m_map = nullptr;
+        this->close();
+        throw std::runtime_error("Could not map file: " + path.string());
+    }
+    ::madvise(m_map, m_map_size, MADV_SEQUENTIAL);
+    m_rows = static_cast<const GeoRow*>(m_map);
+}
+
+void MmapFileReader::advise(size_t pos) {
+    size_t byte_pos = pos * sizeof(GeoRow);
+    size_t byte_end = m_end * sizeof(GeoRow);
+    if (byte_pos + PREFETCH_BYTES / 2 >= m_prefetch_pos && m_prefetch_pos < byte_end) {
+        size_t begin = m_prefetch_pos / page_size() * page_size();
+        size_t end = std::min(byte_end, byte_pos + PREFETCH_BYTES);
+        ::madvise(static_cast<char*>(m_map) + begin, end - begin, MADV_WILLNEED);
+        m_prefetch_pos = end;
+    }
+
+    if (byte_pos >= m_drop_pos + DROP_BYTES) {
+        size_t end = byte_pos / page_size() * page_size();
+        ::madvise(static_cast<char*>(m_map) + m_drop_pos, end - m_drop_pos, MADV_DONTNEED);
+        ::posix_fadvise(m_fd, (off_t)m_drop_pos, (off_t)(end - m_drop_pos),
+            POSIX_FADV_DONTNEED);
+        m_drop_pos = end;
+    }
+}
+
+void MmapFileReader::set_range(size_t begin, size_t end) {
+    if (begin > end || end > m_row_count) {
+        throw std::out_of_range("Invalid range of rows in MmapFileReader");
+    }
+    m_pos = begin;
+    m_end = end;
+    m_prefetch_pos = m_drop_pos = begin * sizeof(GeoRow) / page_size() * page_size();
+}
+
+ArrayView<const GeoRow> MmapFileReader::read_view(size_t max_count) {
+    size_t begin = m_pos;
+    size_t end = std::min(m_end, begin + max_count);
+    m_pos = end;
+    if (m_map) { this->advise(begin); }
+    return {m_rows + begin, m_rows + end};
+}
+
+size_t MmapFileReader::read_batch(ArrayView<GeoRow> out) {
+    auto rows = this->read_view(out.size());
+    std::memcpy(out.begin(), rows.begin(), rows.size() * sizeof(GeoRow));
+    return rows.size();
+}
+
+void MmapFileReader::close() {
+    if (m_map) {
+        ::munmap(m_map, m_map_size);
+        m_map = nullptr;
+        m_rows = nullptr;
+    }
+    m_row_count = 0;
+    m_pos = m_end = 0;
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+}
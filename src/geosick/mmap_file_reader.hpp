@@ -0,0 +1,42 @@
+#pragma once
+#include <filesystem>
+#include "geosick/geo_row_reader.hpp"
+
+namespace geosick {
+
+// Reads a file of GeoRow-s through a read-only memory mapping. Pages ahead of
+// the cursor are prefetched and pages behind the cursor are dropped, so that a
+// merge of many large files does not fill up the page cache.
+class MmapFileReader final: public GeoRowReader {
+    int m_fd = -1;
+    void* m_map = nullptr;
+    size_t m_map_size = 0;
+    const GeoRow* m_rows = nullptr;
+    size_t m_row_count = 0;
+    size_t m_pos = 0;
+    size_t m_end = 0;
+    size_t m_prefetch_pos = 0;
+    size_t m_drop_pos = 0;
+
+    void advise(size_t pos);
+public:
+    explicit MmapFileReader(const std::filesystem::path& path);
+    ~MmapFileReader() { this->close(); }
+    MmapFileReader(const MmapFileReader&) = delete;
+    MmapFileReader& operator=(const MmapFileReader&) = delete;
+
+    // Returns all rows in the file, regardless of the current position
+    ArrayView<const GeoRow> get_rows() const { return {m_rows, m_rows + m_row_count}; }
+    // Restricts the reader to rows with indices in [begin, end)
+    void set_range(size_t begin, size_t end);
+
+    // Returns up to max_count rows directly from the mapping; the view is valid
+    // until the reader is closed.
+    virtual bool has_views() const override { return true; }
+    virtual ArrayView<const GeoRow> read_view(size_t max_count) override;
+    virtual size_t read_batch(ArrayView<GeoRow> out) override;
+
+    void close();
+};
+
+}
@@ -1,12 +1,26 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
 #include <mysql++/dbdriver.h>
 #include "geosick/mysql_db.hpp"
 
 namespace geosick {
 
-static int64_t read_i64(const mysqlpp::String& str) {
-    const char* data = str.data();
-    size_t size = str.size();
+namespace {
+    // Text of a single field in a row fetched from MySQL
+    struct RawField {
+        const char* data;
+        size_t size;
+        bool is_null;
+    };
+}
 
+static int64_t read_i64(const char* data, size_t size) {
     int64_t num = 0;
     bool negative = false;
 
@@ -28,6 +42,14 @@ static int64_t read_i64(const mysqlpp::String& str) {
     return num;
 }
 
+static int64_t read_i64(const mysqlpp::String& str) {
+    return read_i64(str.data(), str.size());
+}
+
+static int64_t read_i64(const RawField& field) {
+    return read_i64(field.data, field.size);
+}
+
 static uint32_t read_u32(const mysqlpp::String& str) {
     return (uint32_t)read_i64(str);
 }
@@ -36,10 +58,6 @@ static int32_t read_i32(const mysqlpp::String& str) {
     return (int32_t)read_i64(str);
 }
 
-static uint16_t read_u16(const mysqlpp::String& str) {
-    return (uint16_t)read_i64(str);
-}
-
 
 
 namespace {
@@ -55,18 +73,32 @@ namespace {
     };
 }
 
-MysqlDb::MysqlDb(const Config& cfg) {
-    auto mode_str = cfg.mysql.ssl_mode;
-    unsigned int mode_flag;
+static unsigned int parse_ssl_mode(const std::string& mode_str) {
     if (mode_str == "DISABLED") {
-        mode_flag = SSL_MODE_DISABLED;
+        return SSL_MODE_DISABLED;
     } else if (mode_str == "PREFERRED") {
-        mode_flag = SSL_MODE_PREFERRED;
+        return SSL_MODE_PREFERRED;
     } else if (mode_str == "REQUIRED") {
-        mode_flag = SSL_MODE_REQUIRED;
+        return SSL_MODE_REQUIRED;
+    }
+    throw std::runtime_error("Invalid value of mysql.ssl_mode: '" + mode_str + "'");
+}
+
+MysqlDb::MysqlDb(const Config& cfg):
+    m_mysql_cfg(cfg.mysql)
+{
+    m_bulk_batch_size = std::max(cfg.mysql.bulk_batch_size, 1u);
+    m_parse_thread_count = cfg.mysql.parse_threads;
+    if (cfg.mysql.dedup_mode == "client") {
+        m_server_dedup = false;
+    } else if (cfg.mysql.dedup_mode == "server") {
+        m_server_dedup = true;
     } else {
-        throw std::runtime_error("Invalid value of mysql.ssl_mode: '" + mode_str + "'");
+        throw std::runtime_error("Invalid value of mysql.dedup_mode: '"
+            + cfg.mysql.dedup_mode + "'");
     }
+
+    unsigned int mode_flag = parse_ssl_mode(cfg.mysql.ssl_mode);
     m_conn.driver()->set_option(new SslModeOption(mode_flag));
 
     m_conn.connect(cfg.mysql.db.c_str(), cfg.mysql.server.c_str(),
@@ -78,17 +110,72 @@ MysqlDb::MysqlDb(const Config& cfg) {
     tz_query.execute();
 }
 
-std::unique_ptr<MysqlReader> MysqlDb::read_rows() {
-    mysqlpp::Query query = m_conn.query(R"(
-        SELECT client_id,
+static std::string rows_query_sql(const char* columns, const MysqlDb::RowFilter& filter) {
+    std::string sql = std::string("SELECT ") + columns + " FROM clients_positions";
+    const char* conjunction = " WHERE ";
+    if (filter.min_timestamp) {
+        sql += conjunction;
+        sql += "created_at >= FROM_UNIXTIME(" + std::to_string(*filter.min_timestamp) + ")";
+        conjunction = " AND ";
+    }
+    if (filter.max_timestamp) {
+        sql += conjunction;
+        sql += "created_at < FROM_UNIXTIME(" + std::to_string(*filter.max_timestamp) + ")";
+        conjunction = " AND ";
+    }
+    if (filter.user_ids) {
+        std::vector<uint32_t> user_ids(filter.user_ids->begin(), filter.user_ids->end());
+        std::sort(user_ids.begin(), user_ids.end());
+        sql += conjunction;
+        if (user_ids.empty()) {
+            sql += "FALSE";
+        } else {
+            sql += "client_id IN (";
+            for (size_t i = 0; i < user_ids.size(); ++i) {
+                if (i > 0) { sql += ", "; }
+                sql += std::to_string(user_ids[i]);
+            }
+            sql += ")";
+        }
+        conjunction = " AND ";
+    }
+    if (filter.client_modulo > 1) {
+        sql += conjunction;
+        sql += "MOD(client_id, " + std::to_string(filter.client_modulo)
+            + ") = " + std::to_string(filter.client_class);
+        conjunction = " AND ";
+    }
+    return sql;
+}
+
+std::unique_ptr<GeoRowReader> MysqlDb::read_rows(const RowFilter& filter) {
+    if (m_mysql_cfg.binary_protocol) {
+        // the coordinates are converted to E7 by the reader
+        auto sql = rows_query_sql(R"(
+                client_id,
+                UNIX_TIMESTAMP(created_at),
+                lat,
+                lng,
+                accurancy,
+                bear,
+                speed
+            )", filter);
+        return std::make_unique<StmtMysqlReader>(m_mysql_cfg, sql);
+    }
+
+    auto sql = rows_query_sql(R"(
+            client_id,
             UNIX_TIMESTAMP(created_at),
             TRUNCATE(CAST(lat AS DECIMAL(10,7))*10000000, 0),
             TRUNCATE(CAST(lng AS DECIMAL(10,7))*10000000, 0),
             accurancy,
             bear,
             speed
-        FROM clients_positions
-    )");
+        )", filter);
+    mysqlpp::Query query = m_conn.query(sql.c_str());
+    if (m_parse_thread_count > 0) {
+        return std::make_unique<PipelinedMysqlReader>(query.use(), m_parse_thread_count);
+    }
     return std::make_unique<MysqlReader>(query.use());
 }
 
@@ -122,9 +209,30 @@ int32_t MysqlDb::read_now_timestamp() {
 }
 
 uint64_t MysqlDb::write_matches(ArrayView<Match> matches) {
-    mysqlpp::Transaction trans(m_conn, mysqlpp::Transaction::read_committed);
+    auto start_time = std::chrono::steady_clock::now();
+    this->begin_matches();
+    uint64_t write_count = this->write_match_batch(matches);
+    this->commit_matches();
+
+    double duration_s = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start_time).count();
+    std::cout << "  wrote " << write_count << " matches to mysql in "
+        << duration_s << " s (" << double(matches.size()) / std::max(duration_s, 1e-9)
+        << " matches/s)" << std::endl;
+    return write_count;
+}
+
+void MysqlDb::begin_matches() {
+    m_match_trans = std::make_unique<mysqlpp::Transaction>(
+        m_conn, mysqlpp::Transaction::read_committed);
+
+    m_found_pairs.clear();
+    if (m_server_dedup) {
+        // duplicate pairs are skipped by the unique key on
+        // (client_id, suspicious_id), so we don't need to read the table
+        return;
+    }
 
-    std::set<std::pair<uint32_t, uint32_t>> found_pairs;
     mysqlpp::Query select_query = m_conn.query(R"(
         SELECT client_id, suspicious_id
         FROM clients_matches
@@ -133,45 +241,416 @@ uint64_t MysqlDb::write_matches(ArrayView<Match> matches) {
     while (auto row = select_res.fetch_row()) {
         uint32_t query_id = read_u32(row.at(0));
         uint32_t sick_id = read_u32(row.at(1));
-        found_pairs.emplace(query_id, sick_id);
+        m_found_pairs.emplace(query_id, sick_id);
     }
+}
 
-    uint64_t write_count = 0;
-    mysqlpp::Query insert_query = m_conn.query(R"(
-        INSERT INTO clients_matches
-            (client_id, suspicious_id, score, distance, match_date)
-        VALUES (%0q, %1q, %2q, %3q, FROM_UNIXTIME(%4q))
-    )");
-    insert_query.parse();
+uint64_t MysqlDb::write_match_batch(ArrayView<const Match> matches) {
+    if (!m_match_trans) {
+        throw std::logic_error("MysqlDb::begin_matches() was not called");
+    }
+    if (m_server_dedup) {
+        return this->insert_matches(matches);
+    }
+
+    std::vector<Match> new_matches;
     for (const Match& m: matches) {
-        if (found_pairs.count(std::make_pair(m.query_id, m.sick_id)) == 0) {
-            insert_query.execute(m.query_id, m.sick_id, m.score,
-                int32_t(m.distance), m.timestamp);
-            write_count += 1;
+        if (m_found_pairs.count(std::make_pair(m.query_id, m.sick_id)) == 0) {
+            new_matches.push_back(m);
         }
     }
+    return this->insert_matches(make_view(new_matches));
+}
+
+void MysqlDb::commit_matches() {
+    if (!m_match_trans) {
+        throw std::logic_error("MysqlDb::begin_matches() was not called");
+    }
+    m_match_trans->commit();
+    m_match_trans.reset();
+    m_found_pairs.clear();
+}
+
+// Inserts the matches using multi-row INSERT statements with up to
+// m_bulk_batch_size rows each
+uint64_t MysqlDb::insert_matches(ArrayView<const Match> matches) {
+    uint64_t write_count = 0;
+    std::string sql;
+    for (size_t batch_begin = 0; batch_begin < matches.size();
+        batch_begin += m_bulk_batch_size)
+    {
+        size_t batch_end = std::min(matches.size(), batch_begin + m_bulk_batch_size);
+        sql = "INSERT INTO clients_matches"
+            " (client_id, suspicious_id, score, distance, match_date) VALUES ";
+        size_t value_count = 0;
+        for (size_t i = batch_begin; i < batch_end; ++i) {
+            const Match& m = matches[i];
+            // "nan" or "inf" in the SQL would make the whole batch fail
+            if (!std::isfinite(m.score) || !std::isfinite(m.distance)) {
+                std::cerr << "Skipping match " << m.query_id << "-" << m.sick_id
+                    << " with non-finite score or distance" << std::endl;
+                continue;
+            }
+            char values[128];
+            std::snprintf(values, sizeof(values),
+                "%s(%" PRIu32 ", %" PRIu32 ", %.17g, %" PRId32 ", FROM_UNIXTIME(%" PRId32 "))",
+                value_count > 0 ? ", " : "", m.query_id, m.sick_id, m.score,
+                int32_t(m.distance), m.timestamp);
+            sql += values;
+            value_count += 1;
+        }
+        if (value_count == 0) { continue; }
+        if (m_server_dedup) {
+            sql += " ON DUPLICATE KEY UPDATE client_id = client_id";
+        }
 
-    trans.commit();
+        mysqlpp::Query insert_query = m_conn.query(sql.c_str());
+        write_count += insert_query.execute().rows();
+    }
     return write_count;
 }
 
-std::optional<GeoRow> MysqlReader::read() {
-    auto row = m_result.fetch_row();
-    if (!row) { return {}; }
+// Number of columns selected by MysqlDb::read_rows()
+static constexpr size_t ROW_FIELD_COUNT = 7;
 
+static GeoRow parse_row(const RawField* fields) {
     GeoRow res;
-    res.user_id = read_u32(row.at(0));
-    res.timestamp_utc_s = read_i32(row.at(1));
-    res.lat = read_i32(row.at(2));
-    res.lon = read_i32(row.at(3));
-    res.accuracy_m = !row.at(4).is_null() ? read_u16(row.at(4)) : 50;
-    if (!row.at(5).is_null()) {
-        res.heading_deg = read_u16(row.at(5));
+    res.user_id = (uint32_t)read_i64(fields[0]);
+    res.timestamp_utc_s = (int32_t)read_i64(fields[1]);
+    res.lat = (int32_t)read_i64(fields[2]);
+    res.lon = (int32_t)read_i64(fields[3]);
+    res.accuracy_m = !fields[4].is_null ? (uint16_t)read_i64(fields[4]) : 50;
+    if (!fields[5].is_null) {
+        res.heading_deg = (uint16_t)read_i64(fields[5]);
     }
-    if (!row.at(6).is_null()) {
-        res.velocity_mps = read_i32(row.at(6));
+    if (!fields[6].is_null) {
+        res.velocity_mps = (int32_t)read_i64(fields[6]);
     }
     return res;
 }
 
+size_t MysqlReader::read_batch(ArrayView<GeoRow> out) {
+    size_t count = 0;
+    while (count < out.size()) {
+        auto row = m_result.fetch_row();
+        if (!row) { break; }
+
+        RawField fields[ROW_FIELD_COUNT];
+        for (size_t i = 0; i < ROW_FIELD_COUNT; ++i) {
+            const mysqlpp::String& field = row.at(i);
+            fields[i] = RawField { field.data(), field.size(), field.is_null() };
+        }
+        out[count++] = parse_row(fields);
+    }
+    return count;
+}
+
+
+// Number of rows that the fetch thread passes to a parse thread at once
+static constexpr size_t RAW_BLOCK_ROW_COUNT = 1024;
+// Number of blocks that can wait in a ring between two threads
+static constexpr size_t PIPELINE_RING_CAPACITY = 8;
+
+PipelinedMysqlReader::PipelinedMysqlReader(mysqlpp::UseQueryResult result,
+    size_t parse_thread_count
+):
+    m_result(result)
+{
+    parse_thread_count = std::max(parse_thread_count, size_t(1));
+    for (size_t i = 0; i < parse_thread_count; ++i) {
+        m_raw_rings.push_back(std::make_unique<SpscRing<RawBlock>>(PIPELINE_RING_CAPACITY));
+        m_row_rings.push_back(std::make_unique<SpscRing<RowBlock>>(PIPELINE_RING_CAPACITY));
+    }
+    m_fetch_thread = std::thread(&PipelinedMysqlReader::run_fetch, this);
+    for (size_t i = 0; i < parse_thread_count; ++i) {
+        m_parse_threads.emplace_back(&PipelinedMysqlReader::run_parse, this, i);
+    }
+}
+
+PipelinedMysqlReader::~PipelinedMysqlReader() {
+    m_stop.store(true);
+    for (auto& ring: m_raw_rings) { ring->wake(); }
+    for (auto& ring: m_row_rings) { ring->wake(); }
+    m_fetch_thread.join();
+    for (auto& thread: m_parse_threads) {
+        thread.join();
+    }
+}
+
+void PipelinedMysqlReader::run_fetch() {
+    // the blocks are distributed to the parse threads in round-robin order,
+    // so read_batch() can restore the order of rows
+    size_t ring_count = m_raw_rings.size();
+    size_t block_idx = 0;
+    for (bool done = false; !done; ++block_idx) {
+        RawBlock block;
+        try {
+            while (block.fields.size() < RAW_BLOCK_ROW_COUNT * ROW_FIELD_COUNT) {
+                MYSQL_ROW row = m_result.fetch_raw_row();
+                if (!row) { done = true; break; }
+                const unsigned long* lengths = m_result.fetch_lengths();
+                for (size_t i = 0; i < ROW_FIELD_COUNT; ++i) {
+                    if (!row[i]) {
+                        block.fields.push_back(RawBlock::Field { 0, RawBlock::NULL_SIZE });
+                        continue;
+                    }
+                    block.fields.push_back(RawBlock::Field {
+                        uint32_t(block.data.size()), uint32_t(lengths[i]) });
+                    block.data.insert(block.data.end(), row[i], row[i] + lengths[i]);
+                }
+            }
+        } catch (...) {
+            block.error = std::current_exception();
+            done = true;
+        }
+
+        block.last = done;
+        if (!m_raw_rings[block_idx % ring_count]->push(block, m_stop)) { return; }
+    }
+
+    for (size_t i = 0; i + 1 < ring_count; ++i) {
+        RawBlock block;
+        block.last = true;
+        if (!m_raw_rings[(block_idx + i) % ring_count]->push(block, m_stop)) { return; }
+    }
+}
+
+void PipelinedMysqlReader::run_parse(size_t ring_idx) {
+    for (;;) {
+        RawBlock raw_block;
+        if (!m_raw_rings[ring_idx]->pop(raw_block, m_stop)) { return; }
+
+        RowBlock block;
+        block.last = raw_block.last;
+        block.error = raw_block.error;
+        if (!block.error) {
+            try {
+                size_t row_count = raw_block.fields.size() / ROW_FIELD_COUNT;
+                block.rows.reserve(row_count);
+                for (size_t i = 0; i < row_count; ++i) {
+                    RawField fields[ROW_FIELD_COUNT];
+                    for (size_t j = 0; j < ROW_FIELD_COUNT; ++j) {
+                        const auto& field = raw_block.fields[i*ROW_FIELD_COUNT + j];
+                        bool is_null = field.size == RawBlock::NULL_SIZE;
+                        fields[j] = RawField { raw_block.data.data() + field.offset,
+                            is_null ? 0 : field.size, is_null };
+                    }
+                    block.rows.push_back(parse_row(fields));
+                }
+            } catch (...) {
+                block.error = std::current_exception();
+                block.last = true;
+            }
+        }
+
+        bool last = block.last;
+        if (!m_row_rings[ring_idx]->push(block, m_stop)) { return; }
+        if (last) { return; }
+    }
+}
+
+size_t PipelinedMysqlReader::read_batch(ArrayView<GeoRow> out) {
+    size_t count = 0;
+    while (count < out.size()) {
+        if (m_block_pos == m_block.rows.size()) {
+            if (m_done) { break; }
+            auto& ring = *m_row_rings[m_block_idx % m_row_rings.size()];
+            if (!ring.pop(m_block, m_stop)) { break; }
+            m_block_idx += 1;
+            m_block_pos = 0;
+            m_done = m_block.last;
+            if (m_block.error) {
+                m_block.rows.clear();
+                std::rethrow_exception(m_block.error);
+            }
+            continue;
+        }
+
+        size_t block_count = std::min(out.size() - count, m_block.rows.size() - m_block_pos);
+        std::copy(m_block.rows.begin() + (ptrdiff_t)m_block_pos,
+            m_block.rows.begin() + (ptrdiff_t)(m_block_pos + block_count),
+            out.begin() + count);
+        m_block_pos += block_count;
+        count += block_count;
+    }
+    return count;
+}
+
+
+// Converts degrees to E7 in the same way as
+// TRUNCATE(CAST(x AS DECIMAL(10,7))*10000000, 0) in MySQL, which rounds the
+// shortest decimal representation of x half away from zero to 7 decimal places
+template<class T>
+static int32_t degrees_to_e7(T value) {
+    // DECIMAL(10,7) saturates at this value
+    static constexpr int64_t MAX_E7 = 9999999999;
+
+    char buf[64];
+    auto res = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::scientific);
+    const char* ptr = buf;
+    bool negative = *ptr == '-';
+    if (negative) { ++ptr; }
+
+    const char* end = res.ptr;
+    const char* exp_ptr = std::find(ptr, end, 'e');
+    const char* exp_digits = exp_ptr + 1;
+    if (exp_digits < end && *exp_digits == '+') { ++exp_digits; }
+    int exp = 0;
+    std::from_chars(exp_digits, end, exp);
+
+    int64_t num = 0;
+    if (exp >= 3) {
+        num = MAX_E7;
+    } else {
+        // power of ten of the current digit, in units of 1e-7
+        int power = exp + 7;
+        for (; ptr < exp_ptr && power >= -1; ++ptr) {
+            if (*ptr == '.') { continue; }
+            int64_t digit = int64_t(*ptr - '0');
+            if (power >= 0) {
+                int64_t scale = 1;
+                for (int i = 0; i < power; ++i) { scale *= 10; }
+                num += digit * scale;
+            } else if (digit >= 5) {
+                num += 1;
+            }
+            --power;
+        }
+        num = std::min(num, MAX_E7);
+    }
+    return (int32_t)(negative ? -num : num);
+}
+
+StmtMysqlReader::StmtMysqlReader(const Config::Mysql& cfg, const std::string& sql) {
+    try {
+        this->open(cfg, sql);
+    } catch (...) {
+        this->close();
+        throw;
+    }
+}
+
+StmtMysqlReader::~StmtMysqlReader() {
+    this->close();
+}
+
+void StmtMysqlReader::open(const Config::Mysql& cfg, const std::string& sql) {
+    m_mysql = mysql_init(nullptr);
+    if (!m_mysql) {
+        throw std::runtime_error("Could not initialize MySQL connection");
+    }
+    unsigned int mode_flag = parse_ssl_mode(cfg.ssl_mode);
+    mysql_options(m_mysql, MYSQL_OPT_SSL_MODE, &mode_flag);
+    if (!mysql_real_connect(m_mysql, cfg.server.c_str(), cfg.user.c_str(),
+        cfg.password.c_str(), cfg.db.c_str(), 0, nullptr, 0))
+    {
+        throw std::runtime_error(std::string("Could not connect to MySQL: ")
+            + mysql_error(m_mysql));
+    }
+    if (mysql_query(m_mysql, "SET time_zone = '+00:00'") != 0) {
+        throw std::runtime_error(std::string("Could not set MySQL time zone: ")
+            + mysql_error(m_mysql));
+    }
+
+    m_stmt = mysql_stmt_init(m_mysql);
+    if (!m_stmt) {
+        throw std::runtime_error(std::string("Could not create MySQL statement: ")
+            + mysql_error(m_mysql));
+    }
+    if (mysql_stmt_prepare(m_stmt, sql.c_str(), sql.size()) != 0) {
+        throw std::runtime_error(std::string("Could not prepare MySQL statement: ")
+            + mysql_stmt_error(m_stmt));
+    }
+
+    // the coordinates are bound in the type of their column, because MySQL
+    // converts FLOAT and DOUBLE to decimal using different precision
+    MYSQL_RES* metadata = mysql_stmt_result_metadata(m_stmt);
+    if (!metadata || mysql_num_fields(metadata) != FIELD_COUNT) {
+        if (metadata) { mysql_free_result(metadata); }
+        throw std::runtime_error("Unexpected columns in MySQL statement");
+    }
+    const MYSQL_FIELD* fields = mysql_fetch_fields(metadata);
+    for (size_t i = 0; i < 2; ++i) {
+        m_float_coords[i] = fields[2 + i].type == MYSQL_TYPE_FLOAT;
+    }
+    mysql_free_result(metadata);
+
+    std::memset(m_binds, 0, sizeof(m_binds));
+    for (size_t i = 0; i < FIELD_COUNT; ++i) {
+        MYSQL_BIND& bind = m_binds[i];
+        bind.is_null = &m_is_null[i];
+        bind.error = &m_error[i];
+        if (i == 2 || i == 3) {
+            if (m_float_coords[i - 2]) {
+                bind.buffer_type = MYSQL_TYPE_FLOAT;
+                bind.buffer = &m_floats[i - 2];
+            } else {
+                bind.buffer_type = MYSQL_TYPE_DOUBLE;
+                bind.buffer = &m_doubles[i - 2];
+            }
+        } else {
+            bind.buffer_type = MYSQL_TYPE_LONGLONG;
+            bind.buffer = &m_ints[i];
+        }
+    }
+
+    if (mysql_stmt_execute(m_stmt) != 0) {
+        throw std::runtime_error(std::string("Could not execute MySQL statement: ")
+            + mysql_stmt_error(m_stmt));
+    }
+    if (mysql_stmt_bind_result(m_stmt, m_binds) != 0) {
+        throw std::runtime_error(std::string("Could not bind MySQL results: ")
+            + mysql_stmt_error(m_stmt));
+    }
+}
+
+void StmtMysqlReader::close() {
+    if (m_stmt) {
+        mysql_stmt_close(m_stmt);
+        m_stmt = nullptr;
+    }
+    if (m_mysql) {
+        mysql_close(m_mysql);
+        m_mysql = nullptr;
+    }
+}
+
+int32_t StmtMysqlReader::get_coord_e7(size_t coord_idx) const {
+    if (m_is_null[2 + coord_idx]) { return 0; }
+    return m_float_coords[coord_idx]
+        ? degrees_to_e7(m_floats[coord_idx])
+        : degrees_to_e7(m_doubles[coord_idx]);
+}
+
+size_t StmtMysqlReader::read_batch(ArrayView<GeoRow> out) {
+    size_t count = 0;
+    while (m_stmt && count < out.size()) {
+        int status = mysql_stmt_fetch(m_stmt);
+        if (status == MYSQL_NO_DATA) {
+            this->close();
+            break;
+        } else if (status == MYSQL_DATA_TRUNCATED) {
+            throw std::runtime_error("Row fetched from MySQL was truncated");
+        } else if (status != 0) {
+            throw std::runtime_error(std::string("Could not fetch row from MySQL: ")
+                + mysql_stmt_error(m_stmt));
+        }
+
+        GeoRow row;
+        row.user_id = (uint32_t)m_ints[0];
+        row.timestamp_utc_s = (int32_t)m_ints[1];
+        row.lat = this->get_coord_e7(0);
+        row.lon = this->get_coord_e7(1);
+        row.accuracy_m = !m_is_null[4] ? (uint16_t)m_ints[4] : 50;
+        if (!m_is_null[5]) {
+            row.heading_deg = (uint16_t)m_ints[5];
+        }
+        if (!m_is_null[6]) {
+            row.velocity_mps = (int32_t)m_ints[6];
+        }
+        out[count++] = row;
+    }
+    return count;
+}
+
 }
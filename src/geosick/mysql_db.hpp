@@ -1,9 +1,16 @@
 #pragma once
+#include <atomic>
+#include <exception>
 #include <mysql++/mysql++.h>
+#include <optional>
+#include <set>
+#include <thread>
+#include <type_traits>
 #include <unordered_set>
 #include "geosick/config.hpp"
 #include "geosick/geo_row_reader.hpp"
 #include "geosick/slice.hpp"
+#include "geosick/spsc_ring.hpp"
 
 namespace geosick {
 
@@ -11,9 +18,26 @@ class MysqlReader;
 
 class MysqlDb {
   mysqlpp::Connection m_conn;
+  Config::Mysql m_mysql_cfg;
+  size_t m_bulk_batch_size;
+  size_t m_parse_thread_count;
+  bool m_server_dedup;
 public:
   explicit MysqlDb(const Config& cfg);
-  std::unique_ptr<MysqlReader> read_rows();
+
+  struct RowFilter {
+      // If set, only rows with created_at at or after this timestamp are read
+      std::optional<int32_t> min_timestamp;
+      // If set, only rows with created_at before this timestamp are read
+      std::optional<int32_t> max_timestamp;
+      // If set, only rows of these users are read; the ids are listed in the
+      // query, so the set should be small
+      const std::unordered_set<uint32_t>* user_ids = nullptr;
+      // Only read rows with client_id % client_modulo == client_class
+      uint32_t client_modulo = 1;
+      uint32_t client_class = 0;
+  };
+  std::unique_ptr<GeoRowReader> read_rows(const RowFilter& filter);
 
   struct UserIds {
       std::unordered_set<uint32_t> sick;
@@ -31,13 +55,95 @@ public:
       int32_t timestamp;
   };
   uint64_t write_matches(ArrayView<Match> matches);
+
+  // Writes matches incrementally in a single transaction: begin_matches() must
+  // be called first, then any number of write_match_batch(), and finally
+  // commit_matches()
+  void begin_matches();
+  uint64_t write_match_batch(ArrayView<const Match> matches);
+  void commit_matches();
+private:
+  std::unique_ptr<mysqlpp::Transaction> m_match_trans;
+  std::set<std::pair<uint32_t, uint32_t>> m_found_pairs;
+
+  uint64_t insert_matches(ArrayView<const Match> matches);
 };
 
 class MysqlReader final: public GeoRowReader {
     mysqlpp::UseQueryResult m_result;
 public:
     explicit MysqlReader(mysqlpp::UseQueryResult result): m_result(result) {}
-    virtual std::optional<GeoRow> read() override;
+    virtual size_t read_batch(ArrayView<GeoRow> out) override;
+};
+
+// Reads rows like MysqlReader, but fetches the rows from MySQL on one thread
+// and parses them on other threads, so that waiting for the network overlaps
+// with parsing. The threads pass blocks of rows through SpscRing-s.
+class PipelinedMysqlReader final: public GeoRowReader {
+    struct RawBlock {
+        static constexpr uint32_t NULL_SIZE = UINT32_MAX;
+        struct Field {
+            uint32_t offset;
+            uint32_t size;
+        };
+        std::vector<char> data;
+        std::vector<Field> fields;
+        bool last = false;
+        std::exception_ptr error;
+    };
+
+    struct RowBlock {
+        std::vector<GeoRow> rows;
+        bool last = false;
+        std::exception_ptr error;
+    };
+
+    mysqlpp::UseQueryResult m_result;
+    std::vector<std::unique_ptr<SpscRing<RawBlock>>> m_raw_rings;
+    std::vector<std::unique_ptr<SpscRing<RowBlock>>> m_row_rings;
+    std::atomic<bool> m_stop { false };
+    std::thread m_fetch_thread;
+    std::vector<std::thread> m_parse_threads;
+
+    RowBlock m_block;
+    size_t m_block_pos = 0;
+    size_t m_block_idx = 0;
+    bool m_done = false;
+
+    void run_fetch();
+    void run_parse(size_t ring_idx);
+public:
+    PipelinedMysqlReader(mysqlpp::UseQueryResult result, size_t parse_thread_count);
+    ~PipelinedMysqlReader();
+    virtual size_t read_batch(ArrayView<GeoRow> out) override;
+};
+
+// Reads rows using a prepared statement, so the columns are transferred in the
+// binary protocol directly into bound buffers. The reader opens its own
+// connection, because mysql++ does not support prepared statements.
+class StmtMysqlReader final: public GeoRowReader {
+    using BindBool = std::remove_pointer_t<decltype(MYSQL_BIND::is_null)>;
+    static constexpr size_t FIELD_COUNT = 7;
+
+    MYSQL* m_mysql = nullptr;
+    MYSQL_STMT* m_stmt = nullptr;
+    MYSQL_BIND m_binds[FIELD_COUNT];
+    int64_t m_ints[FIELD_COUNT];
+    double m_doubles[2];
+    float m_floats[2];
+    bool m_float_coords[2];
+    BindBool m_is_null[FIELD_COUNT];
+    BindBool m_error[FIELD_COUNT];
+
+    void open(const Config::Mysql& cfg, const std::string& sql);
+    void close();
+    int32_t get_coord_e7(size_t coord_idx) const;
+public:
+    StmtMysqlReader(const Config::Mysql& cfg, const std::string& sql);
+    StmtMysqlReader(const StmtMysqlReader&) = delete;
+    StmtMysqlReader& operator=(const StmtMysqlReader&) = delete;
+    ~StmtMysqlReader();
+    virtual size_t read_batch(ArrayView<GeoRow> out) override;
 };
 
 }
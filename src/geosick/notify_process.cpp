@@ -1,5 +1,6 @@
 #include <iostream>
 #include <rapidjson/writer.h>
+#include "geosick/match_uploader.hpp"
 #include "geosick/notify_process.hpp"
 #include "geosick/sampler.hpp"
 
@@ -13,26 +14,28 @@ static void check_bz(int bzerror) {
     }
 }
 
-NotifyProcess::NotifyProcess(const Config* cfg, const Sampler* sampler,
-    MysqlDb* mysql,
-    const std::filesystem::path& matches_path,
-    const std::filesystem::path& selected_matches_path)
+NotifyShard::NotifyShard(const Config* cfg, const Sampler* sampler,
+    MatchUploader* uploader,
+    std::filesystem::path json_path,
+    std::filesystem::path selected_json_path)
 {
     m_cfg = cfg;
     m_sampler = sampler;
-    m_mysql = mysql;
+    m_uploader = uploader;
+    m_json_path = std::move(json_path);
+    m_selected_json_path = std::move(selected_json_path);
 
     if (m_cfg->notify.use_json) {
-        m_json_output.open(matches_path);
+        m_json_output.open(m_json_path);
         if (!m_json_output) {
             throw std::runtime_error("Could not open file for writing: " +
-                matches_path.string());
+                m_json_path.string());
         }
 
-        m_selected_json_file = std::fopen(selected_matches_path.c_str(), "wb");
+        m_selected_json_file = std::fopen(m_selected_json_path.c_str(), "wb");
         if (!m_selected_json_file) {
             throw std::runtime_error("Could not open file for writing: " +
-                selected_matches_path.string());
+                m_selected_json_path.string());
         }
 
         int bzerror = BZ_OK;
@@ -43,7 +46,7 @@ NotifyProcess::NotifyProcess(const Config* cfg, const Sampler* sampler,
     }
 }
 
-NotifyProcess::~NotifyProcess() {
+NotifyShard::~NotifyShard() {
     if (m_selected_json_bzfile) {
         int bzerror = BZ_OK;
         BZ2_bzWriteClose(&bzerror, m_selected_json_bzfile, 0, nullptr, nullptr);
@@ -145,13 +148,26 @@ static void match_to_json(JsonWriter& w, const Sampler& sampler,
     w.EndObject();
 }
 
-void NotifyProcess::notify_json(const MatchInput& mi, const MatchOutput& mo) {
+// Decides whether a match is selected into selected_matches.json.bz2. The
+// decision depends only on the pair of users, so it does not change with the
+// order in which the matches are found.
+static bool select_match(const MatchInput& mi, double probability) {
+    // https://prng.di.unimi.it/splitmix64.c
+    uint64_t x = (uint64_t(mi.query_user_id) << 32) | uint64_t(mi.sick_user_id);
+    x += 0x9e3779b97f4a7c15;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    x = x ^ (x >> 31);
+    return double(x >> 11) * 0x1.0p-53 < probability;
+}
+
+void NotifyShard::notify_json(const MatchInput& mi, const MatchOutput& mo) {
     rapidjson::Writer<rapidjson::StringBuffer> w(m_json_buffer);
     match_to_json(w, *m_sampler, mi, mo, false);
     m_json_output << m_json_buffer.GetString() << std::endl;
     m_json_buffer.Clear();
 
-    if (std::bernoulli_distribution(m_cfg->notify.json_select)(m_rng)) {
+    if (select_match(mi, m_cfg->notify.json_select)) {
         rapidjson::Writer<rapidjson::StringBuffer> w_anon(m_json_buffer);
         match_to_json(w_anon, *m_sampler, mi, mo, true);
         m_json_buffer.Put('\n');
@@ -167,7 +183,7 @@ void NotifyProcess::notify_json(const MatchInput& mi, const MatchOutput& mo) {
     m_json_count += 1;
 }
 
-void NotifyProcess::notify_mysql(const MatchInput& mi, const MatchOutput& mo) {
+void NotifyShard::notify_mysql(const MatchInput& mi, const MatchOutput& mo) {
     MysqlDb::Match m;
     m.query_id = mi.query_user_id;
     m.sick_id = mi.sick_user_id;
@@ -177,9 +193,14 @@ void NotifyProcess::notify_mysql(const MatchInput& mi, const MatchOutput& mo) {
         / (24*60*60) * (24*60*60);
     m_mysql_matches.push_back(m);
     m_mysql_count += 1;
+
+    if (m_uploader && m_mysql_matches.size() >= m_cfg->mysql.bulk_batch_size) {
+        m_uploader->push(std::move(m_mysql_matches));
+        m_mysql_matches.clear();
+    }
 }
 
-void NotifyProcess::notify(const MatchInput& mi, const MatchOutput& mo) {
+void NotifyShard::notify(const MatchInput& mi, const MatchOutput& mo) {
     if (m_cfg->notify.use_json && mo.score >= m_cfg->notify.json_min_score) {
         this->notify_json(mi, mo);
     }
@@ -189,12 +210,7 @@ void NotifyProcess::notify(const MatchInput& mi, const MatchOutput& mo) {
     m_match_count += 1;
 }
 
-void NotifyProcess::close() {
-    uint64_t mysql_write_count = 0;
-    if (m_cfg->notify.use_mysql) {
-        mysql_write_count = m_mysql->write_matches(make_view(m_mysql_matches));
-    }
-
+void NotifyShard::close() {
     if (m_json_output) {
         m_json_output.close();
     }
@@ -210,13 +226,99 @@ void NotifyProcess::close() {
         std::fclose(m_selected_json_file);
         m_selected_json_file = nullptr;
     }
+}
+
+
+NotifyProcess::NotifyProcess(const Config* cfg, const Sampler* sampler,
+    MysqlDb* mysql,
+    const std::filesystem::path& matches_path,
+    const std::filesystem::path& selected_matches_path)
+{
+    m_cfg = cfg;
+    m_sampler = sampler;
+    m_mysql = mysql;
+    m_matches_path = matches_path;
+    m_selected_matches_path = selected_matches_path;
+
+    if (m_cfg->notify.use_mysql && m_cfg->notify.mysql_streaming) {
+        m_uploader = std::make_unique<MatchUploader>(
+            m_mysql, m_cfg->notify.mysql_queue_batches);
+    }
+}
+
+NotifyProcess::~NotifyProcess() {}
+
+NotifyShard* NotifyProcess::add_shard() {
+    // the first shard writes directly to the output files, the other shards
+    // are appended to them in close()
+    auto json_path = m_matches_path;
+    auto selected_json_path = m_selected_matches_path;
+    if (!m_shards.empty()) {
+        auto suffix = "." + std::to_string(m_shards.size());
+        json_path += suffix;
+        selected_json_path += suffix;
+    }
+    m_shards.push_back(std::make_unique<NotifyShard>(m_cfg, m_sampler,
+        m_uploader.get(), json_path, selected_json_path));
+    return m_shards.back().get();
+}
+
+static void append_file(const std::filesystem::path& out_path,
+    const std::filesystem::path& in_path)
+{
+    std::ofstream output(out_path, std::ios::binary | std::ios::app);
+    std::ifstream input(in_path, std::ios::binary);
+    if (!output || !input) {
+        throw std::runtime_error("Could not append file " + in_path.string()
+            + " to " + out_path.string());
+    }
+    if (input.peek() != std::ifstream::traits_type::eof()) {
+        output << input.rdbuf();
+    }
+}
+
+void NotifyProcess::close() {
+    uint64_t match_count = 0;
+    uint64_t json_count = 0;
+    uint64_t selected_json_count = 0;
+    uint64_t mysql_count = 0;
+    std::vector<MysqlDb::Match> mysql_matches;
+    for (auto& shard: m_shards) {
+        match_count += shard->m_match_count;
+        json_count += shard->m_json_count;
+        selected_json_count += shard->m_selected_json_count;
+        mysql_count += shard->m_mysql_count;
+        mysql_matches.insert(mysql_matches.end(),
+            shard->m_mysql_matches.begin(), shard->m_mysql_matches.end());
+        shard->m_mysql_matches.clear();
+    }
+
+    uint64_t mysql_write_count = 0;
+    if (m_uploader) {
+        m_uploader->push(std::move(mysql_matches));
+        mysql_write_count = m_uploader->close();
+    } else if (m_cfg->notify.use_mysql) {
+        mysql_write_count = m_mysql->write_matches(make_view(mysql_matches));
+    }
+
+    for (size_t i = 0; i < m_shards.size(); ++i) {
+        NotifyShard& shard = *m_shards[i];
+        shard.close();
+        if (i > 0 && m_cfg->notify.use_json) {
+            // a sequence of bzip2 streams is itself a valid bzip2 file
+            append_file(m_matches_path, shard.m_json_path);
+            append_file(m_selected_matches_path, shard.m_selected_json_path);
+            std::filesystem::remove(shard.m_json_path);
+            std::filesystem::remove(shard.m_selected_json_path);
+        }
+    }
 
-    std::cout << "Found " << m_match_count << " matches" << std::endl
-        << "  written to matches.json: " << m_json_count << std::endl
+    std::cout << "Found " << match_count << " matches" << std::endl
+        << "  written to matches.json: " << json_count << std::endl
         << "  written to selected_matches.json.bz2: " 
-            << m_selected_json_count << std::endl
+            << selected_json_count << std::endl
         << "  written to mysql: " << mysql_write_count << "/" 
-            << m_mysql_count << std::endl;
+            << mysql_count << std::endl;
 }
 
 }
@@ -2,25 +2,30 @@
 #include <bzlib.h>
 #include <fstream>
 #include <filesystem>
+#include <memory>
 #include <rapidjson/stringbuffer.h>
-#include <random>
 #include "geosick/match.hpp"
 #include "geosick/mysql_db.hpp"
 
 namespace geosick {
 
+class MatchUploader;
 class Sampler;
 
-class NotifyProcess {
+// Part of the output of NotifyProcess that is written by a single thread
+class NotifyShard {
+    friend class NotifyProcess;
+
     const Config* m_cfg;
     const Sampler* m_sampler;
-    MysqlDb* m_mysql;
+    MatchUploader* m_uploader;
+    std::filesystem::path m_json_path;
+    std::filesystem::path m_selected_json_path;
     uint64_t m_match_count { 0 };
 
     std::ofstream m_json_output;
     FILE* m_selected_json_file { nullptr };
     BZFILE* m_selected_json_bzfile { nullptr };
-    std::mt19937 m_rng;
     rapidjson::StringBuffer m_json_buffer;
     uint64_t m_json_count { 0 };
     uint64_t m_selected_json_count { 0 };
@@ -30,13 +35,35 @@ class NotifyProcess {
 
     void notify_json(const MatchInput& mi, const MatchOutput& mo);
     void notify_mysql(const MatchInput& mi, const MatchOutput& mo);
+    void close();
+public:
+    NotifyShard(const Config* cfg, const Sampler* sampler,
+        MatchUploader* uploader,
+        std::filesystem::path json_path,
+        std::filesystem::path selected_json_path);
+    ~NotifyShard();
+    void notify(const MatchInput& mi, const MatchOutput& mo);
+};
+
+class NotifyProcess {
+    const Config* m_cfg;
+    const Sampler* m_sampler;
+    MysqlDb* m_mysql;
+    std::filesystem::path m_matches_path;
+    std::filesystem::path m_selected_matches_path;
+    std::unique_ptr<MatchUploader> m_uploader;
+    std::vector<std::unique_ptr<NotifyShard>> m_shards;
 public:
     NotifyProcess(const Config* cfg, const Sampler* sampler,
         MysqlDb* mysql,
         const std::filesystem::path& matches_path,
         const std::filesystem::path& selected_matches_path);
     ~NotifyProcess();
-    void notify(const MatchInput& mi, const MatchOutput& mo);
+
+    // Adds a shard that can be used concurrently with the other shards. The
+    // outputs of the shards are concatenated in the order in which the shards
+    // were added.
+    NotifyShard* add_shard();
     void close();
 };
 
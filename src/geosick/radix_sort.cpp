@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <array>
+#include <thread>
+#include "geosick/radix_sort.hpp"
+
+namespace geosick {
+
+static constexpr size_t RADIX_BITS = 11;
+static constexpr size_t RADIX_SIZE = size_t(1) << RADIX_BITS;
+static constexpr size_t MAX_DIGIT_COUNT = (64 + RADIX_BITS - 1) / RADIX_BITS;
+// Smaller arrays are sorted with std::sort
+static constexpr size_t MIN_RADIX_SORT_SIZE = 1 << 16;
+// Minimal number of rows that is worth giving to another thread
+static constexpr size_t MIN_THREAD_ROWS = 1 << 18;
+
+using Histogram = std::array<size_t, RADIX_SIZE>;
+
+static size_t get_digit(uint64_t key, size_t digit) {
+    return size_t(key >> (digit * RADIX_BITS)) & (RADIX_SIZE - 1);
+}
+
+static uint32_t get_bit_width(uint64_t value) {
+    uint32_t width = 0;
+    for (; value > 0; value >>= 1) { ++width; }
+    return width;
+}
+
+// Calls fun(thread_idx, begin, end) for thread_count contiguous chunks of
+// [0, size) in parallel
+template<class F>
+static void parallel_chunks(size_t thread_count, size_t size, const F& fun) {
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            fun(t, size * t / thread_count, size * (t + 1) / thread_count);
+        });
+    }
+    fun(size_t(0), size_t(0), size / thread_count);
+    for (auto& thread: threads) {
+        thread.join();
+    }
+}
+
+void radix_sort_rows(std::vector<GeoRow>& rows, size_t thread_count) {
+    size_t size = rows.size();
+    if (size < MIN_RADIX_SORT_SIZE || size > UINT32_MAX) {
+        std::sort(rows.begin(), rows.end(), [](const GeoRow& r1, const GeoRow& r2) {
+            return get_row_key(r1) < get_row_key(r2);
+        });
+        return;
+    }
+    thread_count = std::clamp(thread_count, size_t(1), size / MIN_THREAD_ROWS + 1);
+
+    // the user ids and timestamps are packed into fewer bits than in
+    // get_row_key(), which reduces the number of passes
+    struct Bounds {
+        uint32_t min_user = UINT32_MAX;
+        uint32_t max_user = 0;
+        uint32_t min_time = UINT32_MAX;
+        uint32_t max_time = 0;
+    };
+    std::vector<Bounds> thread_bounds(thread_count);
+    parallel_chunks(thread_count, size, [&](size_t t, size_t begin, size_t end) {
+        Bounds& bounds = thread_bounds[t];
+        for (size_t i = begin; i < end; ++i) {
+            uint64_t key = get_row_key(rows[i]);
+            uint32_t user = uint32_t(key >> 32), time = uint32_t(key);
+            bounds.min_user = std::min(bounds.min_user, user);
+            bounds.max_user = std::max(bounds.max_user, user);
+            bounds.min_time = std::min(bounds.min_time, time);
+            bounds.max_time = std::max(bounds.max_time, time);
+        }
+    });
+    Bounds bounds;
+    for (const Bounds& b: thread_bounds) {
+        bounds.min_user = std::min(bounds.min_user, b.min_user);
+        bounds.max_user = std::max(bounds.max_user, b.max_user);
+        bounds.min_time = std::min(bounds.min_time, b.min_time);
+        bounds.max_time = std::max(bounds.max_time, b.max_time);
+    }
+    uint32_t time_bits = get_bit_width(bounds.max_time - bounds.min_time);
+    uint32_t key_bits = time_bits + get_bit_width(bounds.max_user - bounds.min_user);
+    size_t digit_count = (key_bits + RADIX_BITS - 1) / RADIX_BITS;
+    auto pack_key = [&](const GeoRow& row) {
+        uint64_t key = get_row_key(row);
+        return (uint64_t(uint32_t(key >> 32) - bounds.min_user) << time_bits)
+            | uint64_t(uint32_t(key) - bounds.min_time);
+    };
+
+    // the keys are sorted together with indices of their rows, which are
+    // permuted only once at the end
+    std::vector<uint64_t> keys(size), temp_keys(size);
+    std::vector<uint32_t> indices(size), temp_indices(size);
+    std::vector<std::array<Histogram, MAX_DIGIT_COUNT>> first_histograms(thread_count);
+    parallel_chunks(thread_count, size, [&](size_t t, size_t begin, size_t end) {
+        auto& histograms = first_histograms[t];
+        for (size_t d = 0; d < digit_count; ++d) { histograms[d].fill(0); }
+        for (size_t i = begin; i < end; ++i) {
+            uint64_t key = pack_key(rows[i]);
+            keys[i] = key;
+            indices[i] = uint32_t(i);
+            for (size_t d = 0; d < digit_count; ++d) {
+                histograms[d][get_digit(key, d)] += 1;
+            }
+        }
+    });
+
+    std::vector<Histogram> offsets(thread_count);
+    for (size_t d = 0; d < digit_count; ++d) {
+        // skip the digits that are equal in all keys
+        Histogram total;
+        total.fill(0);
+        for (const auto& histograms: first_histograms) {
+            for (size_t b = 0; b < RADIX_SIZE; ++b) { total[b] += histograms[d][b]; }
+        }
+        if (std::find(total.begin(), total.end(), size) != total.end()) { continue; }
+
+        // the histograms of the first digit were computed together with the
+        // keys; the order of keys has changed for the other digits
+        std::vector<Histogram> histograms(thread_count);
+        parallel_chunks(thread_count, size, [&](size_t t, size_t begin, size_t end) {
+            if (d == 0) {
+                histograms[t] = first_histograms[t][0];
+                return;
+            }
+            histograms[t].fill(0);
+            for (size_t i = begin; i < end; ++i) {
+                histograms[t][get_digit(keys[i], d)] += 1;
+            }
+        });
+
+        size_t offset = 0;
+        for (size_t b = 0; b < RADIX_SIZE; ++b) {
+            for (size_t t = 0; t < thread_count; ++t) {
+                offsets[t][b] = offset;
+                offset += histograms[t][b];
+            }
+        }
+
+        parallel_chunks(thread_count, size, [&](size_t t, size_t begin, size_t end) {
+            auto& thread_offsets = offsets[t];
+            for (size_t i = begin; i < end; ++i) {
+                uint64_t key = keys[i];
+                size_t pos = thread_offsets[get_digit(key, d)]++;
+                temp_keys[pos] = key;
+                temp_indices[pos] = indices[i];
+            }
+        });
+        keys.swap(temp_keys);
+        indices.swap(temp_indices);
+    }
+
+    keys = std::vector<uint64_t>();
+    temp_keys = std::vector<uint64_t>();
+    temp_indices = std::vector<uint32_t>();
+
+    std::vector<GeoRow> sorted_rows(size);
+    parallel_chunks(thread_count, size, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            sorted_rows[i] = rows[indices[i]];
+        }
+    });
+    rows.swap(sorted_rows);
+}
+
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "geosick/geo_row.hpp"
+
+namespace geosick {
+
+// Sorts the rows by get_row_key() using an LSD radix sort on the keys, which
+// runs on up to thread_count threads. The sort needs memory for two copies of
+// the keys and one copy of the rows.
+void radix_sort_rows(std::vector<GeoRow>& rows, size_t thread_count);
+
+}
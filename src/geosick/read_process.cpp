@@ -1,83 +1,332 @@
 #include <algorithm>
+#include <chrono>
+#include <functional>
 #include <future>
 #include <iostream>
-#include "geosick/file_reader.hpp"
+#include <utility>
+#include "geosick/compact_run.hpp"
 #include "geosick/file_writer.hpp"
 #include "geosick/merge_reader.hpp"
+#include "geosick/mmap_file_reader.hpp"
+#include "geosick/radix_sort.hpp"
 #include "geosick/read_process.hpp"
 
 namespace geosick {
 
-namespace {
-    struct CompareRows {
-        bool operator()(const GeoRow& r1, const GeoRow& r2) {
-            if (r1.user_id < r2.user_id) { return true; }
-            if (r1.user_id > r2.user_id) { return false; }
-            return r1.timestamp_utc_s < r2.timestamp_utc_s;
-        }
-    };
-}
+// Number of query rows that are collected for a bucket before they are
+// appended to its file
+static constexpr size_t BUCKET_BUFFER_SIZE = 4096;
 
+// Memory needed to buffer and sort one query row: the row itself, the keys and
+// indices of the radix sort and the sorted copy of the row
+static constexpr uint64_t MEMORY_BYTES_PER_ROW = 2*sizeof(GeoRow) + 2*(8 + 4);
 
-ReadProcess::ReadProcess(const std::unordered_set<uint32_t>* sick_user_ids,
+ReadProcess::ReadProcess(const Config* cfg,
+    const std::unordered_set<uint32_t>* sick_user_ids,
     const std::unordered_set<uint32_t>* query_user_ids,
     std::filesystem::path temp_dir,
     size_t row_buffer_size
 ):
+    m_cfg(cfg),
     m_sick_user_ids(sick_user_ids),
     m_query_user_ids(query_user_ids),
     m_temp_dir(std::move(temp_dir)),
-    m_row_buffer_size(row_buffer_size)
-{}
+    m_row_buffer_size(row_buffer_size),
+    m_compact_temp_files(cfg->compact_temp_files),
+    m_sort_threads(cfg->sort_threads),
+    m_merge_fan_in(std::max(cfg->merge_fan_in, 2u)),
+    m_max_pending_merges(2 * std::max(cfg->merge_threads, 1u)),
+    m_merge_limiter(cfg->merge_bandwidth_mb_s * 1e6),
+    m_memory_budget_rows(cfg->memory_budget_bytes / MEMORY_BYTES_PER_ROW)
+{
+    // without a budget, the rows are always spilled to disk
+    m_spilled.store(m_memory_budget_rows == 0);
+
+    if (cfg->ingest_strategy == "sort") {
+        m_partition_ingest = false;
+    } else if (cfg->ingest_strategy == "partition") {
+        m_partition_ingest = true;
+    } else {
+        throw std::runtime_error("Invalid value of ingest_strategy: '"
+            + cfg->ingest_strategy + "'");
+    }
+
+    if (!m_partition_ingest) {
+        m_merge_pool = std::make_unique<ThreadPool>(std::max(cfg->merge_threads, 1u));
+    } else {
+        // the buckets get roughly the same number of query users
+        std::vector<uint32_t> user_ids(m_query_user_ids->begin(), m_query_user_ids->end());
+        std::sort(user_ids.begin(), user_ids.end());
+        size_t bucket_count = std::max(cfg->partition_bucket_count, 1u);
+        for (size_t i = 1; i < bucket_count && !user_ids.empty(); ++i) {
+            uint32_t splitter = user_ids.at(i * user_ids.size() / bucket_count);
+            if (m_bucket_splitters.empty() || splitter > m_bucket_splitters.back()) {
+                m_bucket_splitters.push_back(splitter);
+            }
+        }
+        for (size_t i = 0; i <= m_bucket_splitters.size(); ++i) {
+            m_buckets.push_back(std::make_unique<Bucket>());
+            m_buckets.back()->path = m_temp_dir / ("bucket_" + std::to_string(i) + ".bin");
+        }
+    }
+}
+
+ReadProcess::~ReadProcess() {
+    // the merges refer to this object, so we must wait for them even if they
+    // failed; a running merge may still schedule another one, so we first wait
+    // until no merge is pending
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_merge_cond.wait(lock, [&]() { return m_pending_merges == 0; });
+    auto futures = std::move(m_merge_futures);
+    m_merge_futures.clear();
+    lock.unlock();
+
+    for (auto& future: futures) {
+        if (future.valid()) { future.wait(); }
+    }
+}
+
+std::unique_ptr<GeoRowWriter> ReadProcess::open_temp_writer(
+    const std::filesystem::path& path) const
+{
+    if (m_compact_temp_files) {
+        return std::make_unique<CompactRunWriter>(path);
+    }
+    return std::make_unique<FileWriter>(path);
+}
+
+// Opens a reader of the rows in a temp file with user_id in [user_begin, user_end)
+std::unique_ptr<GeoRowReader> ReadProcess::open_temp_reader(
+    const std::filesystem::path& path, uint64_t user_begin, uint64_t user_end) const
+{
+    if (m_compact_temp_files) {
+        auto reader = std::make_unique<CompactRunReader>(path);
+        reader->set_user_range(user_begin, user_end);
+        return reader;
+    }
+
+    auto reader = std::make_unique<MmapFileReader>(path);
+    auto rows = reader->get_rows();
+    auto begin = std::partition_point(rows.begin(), rows.end(),
+        [&](const GeoRow& row) { return row.user_id < user_begin; });
+    auto end = std::partition_point(begin, rows.end(),
+        [&](const GeoRow& row) { return row.user_id < user_end; });
+    reader->set_range(size_t(begin - rows.begin()), size_t(end - rows.begin()));
+    return reader;
+}
 
 void ReadProcess::flush_buffer(std::vector<GeoRow> buffer) {
-    std::sort(buffer.begin(), buffer.end(), CompareRows());
+    radix_sort_rows(buffer, m_sort_threads);
 
     std::unique_lock<std::mutex> lock(m_mutex);
     auto temp_path = this->gen_temp_file();
     lock.unlock();
 
-    FileWriter writer(temp_path);
-    writer.write(make_view(buffer));
-    writer.close();
+    auto writer = this->open_temp_writer(temp_path);
+    writer->write(make_view(buffer));
+    writer->close();
 
     lock.lock();
+    m_merge_cond.wait(lock, [&]() { return m_pending_merges < m_max_pending_merges; });
     this->add_temp_file(lock, temp_path, 0);
 }
 
-static void merge_temp_files(const std::filesystem::path& out_file,
+size_t ReadProcess::get_bucket_idx(uint32_t user_id) const {
+    return size_t(std::upper_bound(m_bucket_splitters.begin(), m_bucket_splitters.end(),
+        user_id) - m_bucket_splitters.begin());
+}
+
+void ReadProcess::write_bucket(size_t bucket_idx, ArrayView<const GeoRow> rows) {
+    Bucket& bucket = *m_buckets.at(bucket_idx);
+    std::lock_guard<std::mutex> lock(bucket.mutex);
+    if (!bucket.writer) {
+        bucket.writer = this->open_temp_writer(bucket.path);
+    }
+    bucket.writer->write(rows);
+    bucket.row_count += rows.size();
+}
+
+// Loads all rows from a bucket file, removes the file and sorts the rows
+std::vector<GeoRow> ReadProcess::load_bucket(const std::filesystem::path& path) const {
+    std::vector<GeoRow> rows;
+    {
+        auto reader = this->open_temp_reader(path, 0, UINT64_C(1) << 32);
+        std::vector<GeoRow> batch(ROW_BATCH_SIZE);
+        while (size_t batch_size = reader->read_batch(make_view(batch))) {
+            rows.insert(rows.end(), batch.begin(), batch.begin() + (ptrdiff_t)batch_size);
+        }
+    }
+    std::filesystem::remove(path);
+    radix_sort_rows(rows, m_sort_threads);
+    return rows;
+}
+
+namespace {
+    // Reads the rows from a sequence of buckets, one bucket after another. The
+    // next bucket is loaded and sorted in the background while the rows from
+    // the current bucket are consumed.
+    class BucketReader final: public GeoRowReader {
+        using LoadFun = std::function<std::vector<GeoRow>(const std::filesystem::path&)>;
+        LoadFun m_load;
+        std::vector<std::filesystem::path> m_paths;
+        size_t m_next_idx = 0;
+        std::future<std::vector<GeoRow>> m_next_rows;
+        std::vector<GeoRow> m_rows;
+        size_t m_pos = 0;
+
+        void load_next() {
+            if (m_next_idx < m_paths.size()) {
+                m_next_rows = std::async(std::launch::async, m_load, m_paths.at(m_next_idx++));
+            }
+        }
+    public:
+        BucketReader(LoadFun load, std::vector<std::filesystem::path> paths):
+            m_load(std::move(load)), m_paths(std::move(paths))
+        {
+            this->load_next();
+        }
+
+        virtual size_t read_batch(ArrayView<GeoRow> out) override {
+            size_t count = 0;
+            while (count < out.size()) {
+                if (m_pos == m_rows.size()) {
+                    if (!m_next_rows.valid()) { break; }
+                    m_rows = m_next_rows.get();
+                    m_pos = 0;
+                    this->load_next();
+                    continue;
+                }
+                size_t copy_count = std::min(out.size() - count, m_rows.size() - m_pos);
+                std::copy(m_rows.begin() + (ptrdiff_t)m_pos,
+                    m_rows.begin() + (ptrdiff_t)(m_pos + copy_count),
+                    out.begin() + count);
+                m_pos += copy_count;
+                count += copy_count;
+            }
+            return count;
+        }
+    };
+}
+
+std::vector<std::unique_ptr<GeoRowReader>> ReadProcess::read_bucket_rows(
+    size_t partition_count)
+{
+    uint64_t total_count = 0;
+    for (auto& bucket: m_buckets) {
+        if (bucket->writer) {
+            bucket->writer->close();
+            bucket->writer.reset();
+        }
+        total_count += bucket->row_count;
+    }
+
+    // every partition gets a contiguous range of buckets with roughly the same
+    // number of rows
+    std::vector<std::unique_ptr<GeoRowReader>> readers;
+    std::vector<std::filesystem::path> paths;
+    uint64_t count = 0;
+    auto load = [this](const std::filesystem::path& path) { return this->load_bucket(path); };
+    for (auto& bucket: m_buckets) {
+        if (bucket->row_count == 0) { continue; }
+        paths.push_back(bucket->path);
+        count += bucket->row_count;
+        if (count * partition_count >= total_count * (readers.size() + 1)) {
+            readers.push_back(std::make_unique<BucketReader>(load, std::move(paths)));
+            paths.clear();
+        }
+    }
+    if (!paths.empty() || readers.empty()) {
+        readers.push_back(std::make_unique<BucketReader>(load, std::move(paths)));
+    }
+    return readers;
+}
+
+void ReadProcess::merge_temp_files(const std::filesystem::path& out_file,
     const std::vector<std::filesystem::path>& files)
 {
-    MergeReader<CompareRows> merger { CompareRows() };
+    MergeReader merger;
     for (const auto& path: files) {
-        merger.add_reader(std::make_unique<FileReader>(path));
+        merger.add_reader(this->open_temp_reader(path, 0, UINT64_C(1) << 32));
         std::filesystem::remove(path);
     }
 
-    FileWriter writer(out_file);
-    while (auto row = merger.read()) {
-        writer.write(*row);
+    auto writer = this->open_temp_writer(out_file);
+    std::vector<GeoRow> batch(ROW_BATCH_SIZE);
+    while (size_t batch_size = merger.read_batch(make_view(batch))) {
+        writer->write(make_view(batch.data(), batch.data() + batch_size));
+        // every row is read once and written once
+        m_merge_limiter.acquire(2 * batch_size * sizeof(GeoRow));
     }
+    writer->close();
 }
 
-void ReadProcess::add_temp_file(std::unique_lock<std::mutex>& lock,
+// The mutex must be locked by the caller
+void ReadProcess::add_temp_file(std::unique_lock<std::mutex>&,
     std::filesystem::path path, size_t level)
 {
-    const size_t MAX_MERGE_SIZE = 4;
-    for (;;) {
-        while (m_temp_files.size() <= level) {
-            m_temp_files.emplace_back();
+    while (m_temp_files.size() <= level) {
+        m_temp_files.emplace_back();
+    }
+    m_temp_files.at(level).push_back(path);
+    if (m_temp_files.at(level).size() >= m_merge_fan_in) {
+        std::vector<std::filesystem::path> merge_paths;
+        merge_paths.swap(m_temp_files.at(level));
+        this->schedule_merge(std::move(merge_paths), level);
+    }
+}
+
+// The mutex must be locked by the caller
+void ReadProcess::drop_finished_merges() {
+    auto is_ready = [](const std::future<void>& future) {
+        return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    };
+    auto it = std::partition(m_merge_futures.begin(), m_merge_futures.end(),
+        [&](const std::future<void>& future) { return !is_ready(future); });
+    for (auto jt = it; jt != m_merge_futures.end(); ++jt) {
+        try {
+            jt->get();
+        } catch (...) {
+            if (!m_merge_error) { m_merge_error = std::current_exception(); }
+        }
+    }
+    m_merge_futures.erase(it, m_merge_futures.end());
+}
+
+void ReadProcess::schedule_merge(std::vector<std::filesystem::path> paths, size_t level) {
+    this->drop_finished_merges();
+    auto out_path = this->gen_temp_file();
+    m_pending_merges += 1;
+    m_merge_futures.push_back(m_merge_pool->submit(
+        [this, paths = std::move(paths), out_path, level]()
+    {
+        try {
+            this->merge_temp_files(out_path, paths);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending_merges -= 1;
+            m_merge_cond.notify_all();
+            throw;
         }
-        m_temp_files.at(level).push_back(path);
-        if (m_temp_files.at(level).size() <= MAX_MERGE_SIZE) { break; }
 
-        path = this->gen_temp_file();
-        lock.unlock();
-        merge_temp_files(path, m_temp_files.at(level));
-        lock.lock();
-        m_temp_files.at(level).clear();
-        level += 1;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_pending_merges -= 1;
+        this->add_temp_file(lock, out_path, level + 1);
+        m_merge_cond.notify_all();
+    }));
+}
+
+void ReadProcess::wait_merges() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_merge_cond.wait(lock, [&]() { return m_pending_merges == 0; });
+    auto futures = std::move(m_merge_futures);
+    m_merge_futures.clear();
+    auto error = std::exchange(m_merge_error, nullptr);
+    lock.unlock();
+
+    for (auto& future: futures) {
+        future.get();
     }
+    if (error) { std::rethrow_exception(error); }
 }
 
 std::filesystem::path ReadProcess::gen_temp_file() {
@@ -86,56 +335,272 @@ std::filesystem::path ReadProcess::gen_temp_file() {
 }
 
 void ReadProcess::process(GeoRowReader& reader) {
+    // this method may be called from multiple threads at once, so we collect
+    // the rows and statistics locally and merge them at the end
     std::future<void> flush_future;
     std::vector<GeoRow> buffer;
+    std::vector<GeoRow> sick_rows;
+    uint64_t query_row_count = 0;
+    int32_t min_timestamp = INT32_MAX;
+    int32_t max_timestamp = INT32_MIN;
+    // with a memory budget, rows are counted by the capacity of the buffer,
+    // and the buffer that is being flushed stays counted until it is written
+    size_t budget_counted = 0;
+    size_t flush_counted = 0;
     auto flush = [&] {
         std::cout << "  flush " << buffer.size() << " rows" << std::endl;
-        m_query_row_count += buffer.size();
+        query_row_count += buffer.size();
         if (flush_future.valid()) { flush_future.get(); }
+        m_memory_rows.fetch_sub(flush_counted);
+        flush_counted = budget_counted;
+        budget_counted = 0;
         flush_future = std::async(std::launch::async,
             &ReadProcess::flush_buffer, this, std::move(buffer));
-        buffer.clear();
+        buffer = std::vector<GeoRow>();
+    };
+
+    std::vector<std::vector<GeoRow>> bucket_buffers(m_buckets.size());
+    auto add_bucket_row = [&](const GeoRow& row) {
+        size_t bucket_idx = this->get_bucket_idx(row.user_id);
+        auto& bucket_buffer = bucket_buffers[bucket_idx];
+        bucket_buffer.push_back(row);
+        if (bucket_buffer.size() >= BUCKET_BUFFER_SIZE) {
+            query_row_count += bucket_buffer.size();
+            this->write_bucket(bucket_idx, make_view(bucket_buffer));
+            bucket_buffer.clear();
+        }
+    };
+
+    // with a memory budget, the buffer grows until the rows buffered by all
+    // threads would exceed the budget
+    bool use_budget = m_memory_budget_rows > 0 && !m_partition_ingest;
+    size_t buffer_limit = use_budget ? SIZE_MAX : m_row_buffer_size;
+    auto grow_buffer = [&] {
+        for (;;) {
+            size_t capacity = std::max(2*buffer.capacity(), ROW_BATCH_SIZE);
+            uint64_t added = capacity - budget_counted;
+            if (m_memory_rows.fetch_add(added) + added <= m_memory_budget_rows
+                || buffer.empty())
+            {
+                buffer.reserve(capacity);
+                budget_counted = capacity;
+                return;
+            }
+            m_memory_rows.fetch_sub(added);
+            m_spilled.store(true);
+            flush();
+        }
     };
 
-    buffer.reserve(m_row_buffer_size);
-    while (auto row = reader.read()) {
-        m_min_timestamp = std::min(m_min_timestamp, row->timestamp_utc_s);
-        m_max_timestamp = std::max(m_max_timestamp, row->timestamp_utc_s);
-
-        if (m_sick_user_ids->count(row->user_id)) {
-            m_sick_rows.push_back(*row);
-        } else if (m_query_user_ids->count(row->user_id)) {
-            buffer.push_back(*row);
-            if (buffer.size() >= m_row_buffer_size) {
-                flush();
-                buffer.reserve(m_row_buffer_size);
+    if (!m_partition_ingest && !use_budget) {
+        buffer.reserve(m_row_buffer_size);
+    }
+    std::vector<GeoRow> batch(ROW_BATCH_SIZE);
+    while (size_t batch_size = reader.read_batch(make_view(batch))) {
+        for (size_t i = 0; i < batch_size; ++i) {
+            const GeoRow& row = batch[i];
+            min_timestamp = std::min(min_timestamp, row.timestamp_utc_s);
+            max_timestamp = std::max(max_timestamp, row.timestamp_utc_s);
+
+            // rows are classified here rather than in a stage of the MySQL
+            // reader, because the user sets belong to ReadProcess and the
+            // snapshot feeds rows through the same path; the two lookups are
+            // cheap compared to parsing
+            if (m_sick_user_ids->count(row.user_id)) {
+                sick_rows.push_back(row);
+            } else if (m_query_user_ids->count(row.user_id)) {
+                if (m_partition_ingest) {
+                    add_bucket_row(row);
+                    continue;
+                }
+                if (use_budget && buffer.size() == buffer.capacity()) {
+                    grow_buffer();
+                }
+                buffer.push_back(row);
+                if (buffer.size() >= buffer_limit) {
+                    flush();
+                    buffer.reserve(m_row_buffer_size);
+                }
             }
         }
     }
 
-    if (buffer.size() > 0) {
-        flush();
+    if (use_budget && !m_spilled.load()) {
+        // the rows stay counted in m_memory_rows
+        query_row_count += buffer.size();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_memory_runs.push_back(std::move(buffer));
+        buffer.clear();
+    } else {
+        if (buffer.size() > 0) { flush(); }
+        m_memory_rows.fetch_sub(budget_counted);
+        budget_counted = 0;
+    }
+    for (size_t i = 0; i < bucket_buffers.size(); ++i) {
+        if (bucket_buffers[i].empty()) { continue; }
+        query_row_count += bucket_buffers[i].size();
+        this->write_bucket(i, make_view(bucket_buffers[i]));
     }
-    std::sort(m_sick_rows.begin(), m_sick_rows.end(), CompareRows());
     if (flush_future.valid()) { flush_future.get(); }
+    m_memory_rows.fetch_sub(flush_counted);
 
-    std::cout << "  loaded " << m_query_row_count << " query rows, "
-        << m_sick_rows.size() << " sick rows" << std::endl;
+    std::cout << "  loaded " << query_row_count << " query rows, "
+        << sick_rows.size() << " sick rows" << std::endl;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_sick_rows.insert(m_sick_rows.end(), sick_rows.begin(), sick_rows.end());
+    m_query_row_count += query_row_count;
+    m_min_timestamp = std::min(m_min_timestamp, min_timestamp);
+    m_max_timestamp = std::max(m_max_timestamp, max_timestamp);
 }
 
-std::unique_ptr<GeoRowReader> ReadProcess::read_query_rows() {
-    auto merger = std::make_unique<MergeReader<CompareRows>>(CompareRows());
-    for (auto& paths: m_temp_files) {
+// Picks user ids that split the rows in the sorted files into
+// partition_count ranges of roughly equal size
+std::vector<uint32_t> ReadProcess::sample_splitters(
+    const std::vector<std::filesystem::path>& paths, size_t partition_count) const
+{
+    const size_t SAMPLES_PER_PARTITION = 256;
+    if (partition_count <= 1) { return {}; }
+
+    std::vector<uint32_t> samples;
+    if (m_compact_temp_files) {
+        // every block contributes its first user id, so the partitions are
+        // balanced with the granularity of blocks
+        for (const auto& path: paths) {
+            CompactRunReader reader(path);
+            for (const auto& header: reader.get_block_headers()) {
+                samples.push_back(header.first_user_id);
+            }
+        }
+    } else {
+        std::vector<std::unique_ptr<MmapFileReader>> readers;
+        size_t row_count = 0;
         for (const auto& path: paths) {
-            merger->add_reader(std::make_unique<FileReader>(path));
-            std::filesystem::remove(path);
+            readers.push_back(std::make_unique<MmapFileReader>(path));
+            row_count += readers.back()->get_rows().size();
+        }
+
+        size_t stride = std::max(size_t(1),
+            row_count / (partition_count * SAMPLES_PER_PARTITION));
+        for (const auto& reader: readers) {
+            auto rows = reader->get_rows();
+            for (size_t i = stride / 2; i < rows.size(); i += stride) {
+                samples.push_back(rows[i].user_id);
+            }
+        }
+    }
+    std::sort(samples.begin(), samples.end());
+
+    std::vector<uint32_t> splitters;
+    for (size_t p = 1; p < partition_count && !samples.empty(); ++p) {
+        uint32_t splitter = samples.at(p * samples.size() / partition_count);
+        if (splitter > 0 && (splitters.empty() || splitter > splitters.back())) {
+            splitters.push_back(splitter);
         }
-        paths.clear();
     }
-    return merger;
+    return splitters;
+}
+
+namespace {
+    // Reads a range of rows from a vector that is shared by multiple readers
+    class MemoryRowReader final: public GeoRowReader {
+        std::shared_ptr<const std::vector<GeoRow>> m_rows;
+        size_t m_pos;
+        size_t m_end;
+    public:
+        MemoryRowReader(std::shared_ptr<const std::vector<GeoRow>> rows,
+            size_t begin, size_t end
+        ):
+            m_rows(std::move(rows)), m_pos(begin), m_end(end) {}
+
+        virtual size_t read_batch(ArrayView<GeoRow> out) override {
+            size_t count = std::min(out.size(), m_end - m_pos);
+            std::copy(m_rows->begin() + (ptrdiff_t)m_pos,
+                m_rows->begin() + (ptrdiff_t)(m_pos + count), out.begin());
+            m_pos += count;
+            return count;
+        }
+    };
+}
+
+// Sorts the query rows that fit into the memory budget and splits them into
+// partitions without touching the disk
+std::vector<std::unique_ptr<GeoRowReader>> ReadProcess::read_memory_rows(
+    size_t partition_count)
+{
+    auto rows = std::make_shared<std::vector<GeoRow>>();
+    rows->reserve(m_memory_rows.load());
+    for (auto& run: m_memory_runs) {
+        rows->insert(rows->end(), run.begin(), run.end());
+        run = std::vector<GeoRow>();
+    }
+    m_memory_runs.clear();
+    radix_sort_rows(*rows, m_sort_threads);
+    std::cout << "  kept " << rows->size() << " query rows in memory" << std::endl;
+
+    // the partitions are split at user boundaries
+    std::vector<std::unique_ptr<GeoRowReader>> readers;
+    size_t row_count = rows->size();
+    size_t begin = 0;
+    for (size_t p = 1; p <= partition_count; ++p) {
+        size_t end = std::max(begin, row_count * p / partition_count);
+        while (end > 0 && end < row_count && (*rows)[end].user_id == (*rows)[end - 1].user_id) {
+            ++end;
+        }
+        if (end > begin || readers.empty()) {
+            readers.push_back(std::make_unique<MemoryRowReader>(rows, begin, end));
+        }
+        begin = end;
+    }
+    return readers;
+}
+
+std::vector<std::unique_ptr<GeoRowReader>> ReadProcess::read_query_rows(
+    size_t partition_count)
+{
+    if (m_partition_ingest) {
+        return this->read_bucket_rows(partition_count);
+    }
+    if (!m_spilled.load()) {
+        return this->read_memory_rows(partition_count);
+    }
+
+    // the rows that were kept in memory before we ran out of the budget
+    for (auto& rows: m_memory_runs) {
+        size_t capacity = rows.capacity();
+        this->flush_buffer(std::move(rows));
+        m_memory_rows.fetch_sub(capacity);
+    }
+    m_memory_runs.clear();
+    this->wait_merges();
+
+    std::vector<std::filesystem::path> paths;
+    for (auto& level_paths: m_temp_files) {
+        paths.insert(paths.end(), level_paths.begin(), level_paths.end());
+        level_paths.clear();
+    }
+
+    auto splitters = this->sample_splitters(paths, partition_count);
+    std::vector<std::unique_ptr<GeoRowReader>> readers;
+    for (size_t p = 0; p <= splitters.size(); ++p) {
+        uint64_t user_begin = p > 0 ? splitters.at(p - 1) : 0;
+        uint64_t user_end = p < splitters.size() ? splitters.at(p) : UINT64_C(1) << 32;
+
+        auto merger = std::make_unique<MergeReader>();
+        for (const auto& path: paths) {
+            merger->add_reader(this->open_temp_reader(path, user_begin, user_end));
+        }
+        readers.push_back(std::move(merger));
+    }
+
+    for (const auto& path: paths) {
+        std::filesystem::remove(path);
+    }
+    return readers;
 }
 
 std::vector<GeoRow> ReadProcess::read_sick_rows() {
+    radix_sort_rows(m_sick_rows, m_sort_threads);
     return std::move(m_sick_rows);
 }
 
@@ -1,17 +1,29 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
+#include <exception>
 #include <filesystem>
+#include <future>
+#include <memory>
 #include <mutex>
 #include <vector>
 #include <unordered_set>
+#include "geosick/bandwidth_limiter.hpp"
+#include "geosick/config.hpp"
 #include "geosick/geo_row_reader.hpp"
+#include "geosick/geo_row_writer.hpp"
+#include "geosick/thread_pool.hpp"
 
 namespace geosick {
 
 class ReadProcess {
+    const Config* m_cfg;
     const std::unordered_set<uint32_t>* m_sick_user_ids;
     const std::unordered_set<uint32_t>* m_query_user_ids;
     std::filesystem::path m_temp_dir;
     size_t m_row_buffer_size;
+    bool m_compact_temp_files;
+    size_t m_sort_threads;
 
     std::mutex m_mutex;
     std::vector<GeoRow> m_sick_rows;
@@ -21,18 +33,73 @@ class ReadProcess {
     int32_t m_max_timestamp = INT32_MIN;
     uint64_t m_query_row_count = 0;
 
+    // Temp files are merged in the background by the merge pool. Flushing
+    // waits only when too many merges are pending.
+    size_t m_merge_fan_in;
+    size_t m_max_pending_merges;
+    size_t m_pending_merges = 0;
+    std::condition_variable m_merge_cond;
+    // Futures of merges that may still be running; finished ones are dropped
+    // when a new merge is scheduled, keeping the first error in m_merge_error
+    std::vector<std::future<void>> m_merge_futures;
+    std::exception_ptr m_merge_error;
+    BandwidthLimiter m_merge_limiter;
+    std::unique_ptr<ThreadPool> m_merge_pool;
+
+    // With the "partition" ingest strategy, query rows are not sorted while
+    // reading, but appended to buckets of disjoint ranges of user ids. Bucket i
+    // contains users in [m_bucket_splitters[i-1], m_bucket_splitters[i]).
+    struct Bucket {
+        std::mutex mutex;
+        std::filesystem::path path;
+        std::unique_ptr<GeoRowWriter> writer;
+        uint64_t row_count = 0;
+    };
+    // With a memory budget, query rows are kept in memory until the rows
+    // buffered by all threads would not fit into the budget. After that, all
+    // rows are spilled to disk as usual.
+    uint64_t m_memory_budget_rows;
+    std::atomic<uint64_t> m_memory_rows { 0 };
+    std::atomic<bool> m_spilled { false };
+    std::vector<std::vector<GeoRow>> m_memory_runs;
+
+    bool m_partition_ingest;
+    std::vector<uint32_t> m_bucket_splitters;
+    std::vector<std::unique_ptr<Bucket>> m_buckets;
+
     void flush_buffer(std::vector<GeoRow> buffer);
     void add_temp_file(std::unique_lock<std::mutex>& lock,
         std::filesystem::path path, size_t level);
+    void drop_finished_merges();
+    void schedule_merge(std::vector<std::filesystem::path> paths, size_t level);
+    void wait_merges();
     std::filesystem::path gen_temp_file();
+    std::unique_ptr<GeoRowWriter> open_temp_writer(const std::filesystem::path& path) const;
+    std::unique_ptr<GeoRowReader> open_temp_reader(const std::filesystem::path& path,
+        uint64_t user_begin, uint64_t user_end) const;
+    void merge_temp_files(const std::filesystem::path& out_file,
+        const std::vector<std::filesystem::path>& files);
+    std::vector<uint32_t> sample_splitters(
+        const std::vector<std::filesystem::path>& paths, size_t partition_count) const;
+    size_t get_bucket_idx(uint32_t user_id) const;
+    void write_bucket(size_t bucket_idx, ArrayView<const GeoRow> rows);
+    std::vector<GeoRow> load_bucket(const std::filesystem::path& path) const;
+    std::vector<std::unique_ptr<GeoRowReader>> read_bucket_rows(size_t partition_count);
+    std::vector<std::unique_ptr<GeoRowReader>> read_memory_rows(size_t partition_count);
 public:
-    ReadProcess(const std::unordered_set<uint32_t>* sick_user_ids,
+    ReadProcess(const Config* cfg,
+        const std::unordered_set<uint32_t>* sick_user_ids,
         const std::unordered_set<uint32_t>* query_user_ids,
         std::filesystem::path temp_dir,
         size_t row_buffer_size);
+    ~ReadProcess();
+    // Reads all rows from the reader; may be called concurrently for
+    // multiple readers
     void process(GeoRowReader& reader);
 
-    std::unique_ptr<GeoRowReader> read_query_rows();
+    // Splits the query rows into partition_count readers over disjoint ranges
+    // of user ids; the rows of every user end up in a single reader.
+    std::vector<std::unique_ptr<GeoRowReader>> read_query_rows(size_t partition_count);
     std::vector<GeoRow> read_sick_rows();
 
     int32_t get_min_timestamp() const { return m_min_timestamp; }
@@ -52,6 +52,10 @@ int32_t Sampler::time_index_to_timestamp(int32_t time_index) const {
     return m_begin_time + m_period * time_index;
 }
 
+int32_t Sampler::get_min_row_timestamp() const {
+    return m_begin_time - MAX_DELTA_TIME;
+}
+
 void
 Sampler::sample(ArrayView<const GeoRow> rows, std::vector<GeoSample>& out_samples) const
 {
@@ -28,6 +28,9 @@ public:
 
     int32_t time_index_to_timestamp(int32_t time_index) const;
 
+    // Rows older than this timestamp never contribute to any sample
+    int32_t get_min_row_timestamp() const;
+
     void
     sample(ArrayView<const GeoRow> rows, std::vector<GeoSample>& out_samples) const;
 
@@ -3,46 +3,88 @@
 #include "geosick/file_writer.hpp"
 #include "geosick/geo_search.hpp"
 #include "geosick/search_process.hpp"
+#include "geosick/thread_pool.hpp"
 
 namespace geosick {
 
+// Number of users that may wait in the pool per thread before we block
+static constexpr size_t PENDING_JOBS_PER_THREAD = 16;
+
 SearchProcess::SearchProcess(const Config* cfg, const Sampler* sampler,
-    const GeoSearch* search, const SickMap* sick_map, NotifyProcess* notify_proc)
+    const GeoSearch* search, const SickMap* sick_map, NotifyShard* notify_shard,
+    ThreadPool* pool)
 : m_cfg(cfg), m_sampler(sampler), m_search(search),
-  m_sick_map(sick_map), m_notify_proc(notify_proc)
+  m_sick_map(sick_map), m_notify_shard(notify_shard), m_pool(pool)
 {}
 
+SearchProcess::~SearchProcess() {
+    for (auto& job: m_pending_jobs) {
+        if (job->future.valid()) { job->future.wait(); }
+    }
+}
 
-void SearchProcess::flush_user_rows() {
-    m_sampler->sample(make_view(m_current_rows), m_current_samples);
 
-    std::unordered_set<uint32_t> sick_ids;
-    for (const auto& sample: m_current_samples) {
-        m_search->find_users_within_circle(sample.lat, sample.lon,
-            sample.accuracy_m, sample.time_index, sick_ids);
-    }
+void SearchProcess::search_user(UserJob& job) const {
+    m_sampler->sample(make_view(job.rows), job.samples);
 
+    auto sick_ids = m_search->find_user_ids_along_trajectory(make_view(job.samples));
     for (uint32_t sick_id: sick_ids) {
         MatchInput mi;
-        mi.query_user_id = m_current_user_id;
-        mi.query_rows = make_view(m_current_rows);
-        mi.query_samples = make_view(m_current_samples);
+        mi.query_user_id = job.user_id;
+        mi.query_rows = make_view(job.rows);
+        mi.query_samples = make_view(job.samples);
 
         mi.sick_user_id = sick_id;
         size_t sick_idx = m_sick_map->user_id_to_idx.at(sick_id);
         mi.sick_rows = m_sick_map->rows_by_idx(sick_idx);
         mi.sick_samples = m_sick_map->samples_by_idx(sick_idx);
-        
+
         MatchOutput mo = evaluate_match(*m_cfg, mi);
-        m_notify_proc->notify(mi, mo);
+        job.matches.emplace_back(mi, std::move(mo));
+    }
+}
+
+void SearchProcess::finish_user(UserJob& job) {
+    for (const auto& [mi, mo]: job.matches) {
+        m_notify_shard->notify(mi, mo);
     }
 
     m_user_count += 1;
-    m_row_count += m_current_rows.size();
-    m_sample_count += m_current_samples.size();
+    m_row_count += job.rows.size();
+    m_sample_count += job.samples.size();
+}
 
-    m_current_samples.clear();
+void SearchProcess::finish_jobs(size_t max_pending_count) {
+    // the jobs are finished in the order in which they were submitted, so the
+    // matches are notified in the same order as without the pool
+    while (!m_pending_jobs.empty()) {
+        UserJob& job = *m_pending_jobs.front();
+        if (m_pending_jobs.size() <= max_pending_count && job.future.wait_for(
+            std::chrono::seconds(0)) != std::future_status::ready) { break; }
+        job.future.get();
+        this->finish_user(job);
+        m_pending_jobs.pop_front();
+    }
+}
+
+void SearchProcess::flush_user_rows() {
+    if (m_current_rows.empty()) { return; }
+
+    auto job = std::make_unique<UserJob>();
+    job->user_id = m_current_user_id;
+    job->rows = std::move(m_current_rows);
     m_current_rows.clear();
+
+    if (!m_pool) {
+        this->search_user(*job);
+        this->finish_user(*job);
+        return;
+    }
+
+    UserJob* job_ptr = job.get();
+    job->future = m_pool->submit([this, job_ptr] { this->search_user(*job_ptr); });
+    m_pending_jobs.push_back(std::move(job));
+    this->finish_jobs(PENDING_JOBS_PER_THREAD * m_pool->get_thread_count());
 }
 
 void SearchProcess::process_query_row(const GeoRow& row) {
@@ -54,8 +96,15 @@ void SearchProcess::process_query_row(const GeoRow& row) {
     m_current_rows.push_back(row);
 }
 
+void SearchProcess::process_query_rows(ArrayView<const GeoRow> rows) {
+    for (const auto& row: rows) {
+        this->process_query_row(row);
+    }
+}
+
 void SearchProcess::close() {
     this->flush_user_rows();
+    this->finish_jobs(0);
     std::cout << "Search process stats:" << std::endl
         << "  query users: " << m_user_count << std::endl
         << "  query rows: " << m_row_count << std::endl
@@ -1,4 +1,7 @@
 #pragma once
+#include <deque>
+#include <future>
+#include <memory>
 #include <unordered_set>
 #include "geosick/notify_process.hpp"
 #include "geosick/sampler.hpp"
@@ -8,28 +11,44 @@ namespace geosick {
 
 class FileWriter;
 class GeoSearch;
+class ThreadPool;
 
 class SearchProcess {
     const Config* m_cfg;
     const Sampler* m_sampler;
     const GeoSearch* m_search;
     const SickMap* m_sick_map;
-    NotifyProcess* m_notify_proc;
+    NotifyShard* m_notify_shard;
+    ThreadPool* m_pool;
+
+    struct UserJob {
+        uint32_t user_id;
+        std::vector<GeoRow> rows;
+        std::vector<GeoSample> samples;
+        std::vector<std::pair<MatchInput, MatchOutput>> matches;
+        std::future<void> future;
+    };
+    std::deque<std::unique_ptr<UserJob>> m_pending_jobs;
 
     uint32_t m_current_user_id = 0;
     std::vector<GeoRow> m_current_rows;
-    std::vector<GeoSample> m_current_samples;
 
     uint64_t m_user_count { 0 };
     uint64_t m_row_count { 0 };
     uint64_t m_sample_count { 0 };
 
     void flush_user_rows();
+    void search_user(UserJob& job) const;
+    void finish_user(UserJob& job);
+    void finish_jobs(size_t max_pending_count);
 
 public:
     SearchProcess(const Config* cfg, const Sampler* sampler,
-        const GeoSearch* search, const SickMap* sick_map, NotifyProcess* notify_proc);
+        const GeoSearch* search, const SickMap* sick_map, NotifyShard* notify_shard,
+        ThreadPool* pool = nullptr);
+    ~SearchProcess();
     void process_query_row(const GeoRow& row);
+    void process_query_rows(ArrayView<const GeoRow> rows);
     void close();
 };
 
@@ -0,0 +1,215 @@
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <unistd.h>
+#include "geosick/file_writer.hpp"
+#include "geosick/merge_reader.hpp"
+#include "geosick/mmap_file_reader.hpp"
+#include "geosick/radix_sort.hpp"
+#include "geosick/read_process.hpp"
+#include "geosick/snapshot.hpp"
+
+namespace geosick {
+
+static const char* MANIFEST_NAME = "manifest.json";
+
+// Returns true for the files that a snapshot creates, except the manifest
+static bool is_snapshot_file(const std::string& name) {
+    auto has_prefix = [&](const std::string& prefix) {
+        return name.compare(0, prefix.size(), prefix) == 0;
+    };
+    auto has_suffix = [&](const std::string& suffix) {
+        return name.size() >= suffix.size()
+            && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+    return ((has_prefix("delta_") || has_prefix("base_")) && has_suffix(".bin"))
+        || name == std::string(MANIFEST_NAME) + ".tmp";
+}
+
+static void sync_dir(const std::filesystem::path& dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open directory: " + dir.string());
+    }
+    int res = ::fsync(fd);
+    ::close(fd);
+    if (res != 0) {
+        throw std::runtime_error("Error when syncing directory: " + dir.string());
+    }
+}
+
+namespace {
+    // Reads the rows that are not older than min_timestamp and writes them to
+    // the new base
+    class BaseWriterReader final: public GeoRowReader {
+        GeoRowReader* m_reader;
+        FileWriter* m_writer;
+        int32_t m_min_timestamp;
+    public:
+        uint64_t m_row_count = 0;
+        uint64_t m_dropped_count = 0;
+
+        BaseWriterReader(GeoRowReader* reader, FileWriter* writer, int32_t min_timestamp):
+            m_reader(reader), m_writer(writer), m_min_timestamp(min_timestamp) {}
+
+        virtual size_t read_batch(ArrayView<GeoRow> out) override {
+            size_t count = 0;
+            while (count == 0) {
+                size_t read_count = m_reader->read_batch(out);
+                if (read_count == 0) { break; }
+                for (size_t i = 0; i < read_count; ++i) {
+                    if (out[i].timestamp_utc_s >= m_min_timestamp) {
+                        out[count++] = out[i];
+                    }
+                }
+                m_dropped_count += read_count - count;
+            }
+            m_writer->write(make_view(out.begin(), out.begin() + count));
+            m_row_count += count;
+            return count;
+        }
+    };
+}
+
+Snapshot::Snapshot(std::filesystem::path dir, size_t row_buffer_size,
+    size_t sort_threads
+):
+    m_dir(std::move(dir)),
+    m_row_buffer_size(row_buffer_size),
+    m_sort_threads(sort_threads)
+{
+    std::filesystem::create_directories(m_dir);
+
+    auto manifest_path = m_dir / MANIFEST_NAME;
+    if (std::filesystem::exists(manifest_path)) {
+        nlohmann::json manifest; {
+            std::ifstream manifest_file(manifest_path);
+            manifest_file >> manifest;
+        }
+        m_generation = manifest.at("generation").get<uint32_t>();
+        m_high_water_mark = manifest.at("high_water_mark").get<int32_t>();
+        m_base_path = m_dir / manifest.at("base").get<std::string>();
+    }
+
+    // remove files left behind by runs that did not commit; other files in the
+    // directory are not ours, so they are kept
+    for (const auto& entry: std::filesystem::directory_iterator(m_dir)) {
+        if (!entry.is_regular_file()) { continue; }
+        const auto& path = entry.path();
+        if (m_base_path && path == *m_base_path) { continue; }
+        if (is_snapshot_file(path.filename().string())) {
+            std::filesystem::remove(path);
+        }
+    }
+
+    if (m_high_water_mark) {
+        std::cout << "  snapshot generation " << m_generation
+            << ", high-water mark " << *m_high_water_mark << std::endl;
+    } else {
+        std::cout << "  snapshot is empty" << std::endl;
+    }
+}
+
+void Snapshot::write_delta(std::vector<GeoRow> rows) {
+    radix_sort_rows(rows, m_sort_threads);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto path = m_dir / ("delta_" + std::to_string(m_delta_counter++) + ".bin");
+    lock.unlock();
+
+    FileWriter writer(path);
+    writer.write(make_view(rows));
+    writer.close();
+
+    lock.lock();
+    m_delta_paths.push_back(path);
+}
+
+void Snapshot::add_delta(GeoRowReader& reader) {
+    std::vector<GeoRow> buffer;
+    buffer.reserve(m_row_buffer_size);
+    std::vector<GeoRow> batch(ROW_BATCH_SIZE);
+    uint64_t row_count = 0;
+    while (size_t batch_size = reader.read_batch(make_view(batch))) {
+        for (size_t i = 0; i < batch_size; ++i) {
+            buffer.push_back(batch[i]);
+            if (buffer.size() >= m_row_buffer_size) {
+                row_count += buffer.size();
+                this->write_delta(std::move(buffer));
+                buffer.clear();
+                buffer.reserve(m_row_buffer_size);
+            }
+        }
+    }
+    if (!buffer.empty()) {
+        row_count += buffer.size();
+        this->write_delta(std::move(buffer));
+    }
+    std::cout << "  loaded " << row_count << " delta rows" << std::endl;
+}
+
+void Snapshot::write_manifest() {
+    nlohmann::json manifest;
+    manifest["generation"] = m_generation;
+    manifest["high_water_mark"] = *m_high_water_mark;
+    manifest["base"] = m_base_path->filename().string();
+
+    // the manifest is replaced atomically, so a crash leaves either the old or
+    // the new snapshot
+    auto temp_path = m_dir / (std::string(MANIFEST_NAME) + ".tmp");
+    std::string manifest_str = manifest.dump() + "\n";
+    FILE* manifest_file = std::fopen(temp_path.c_str(), "w");
+    if (!manifest_file) {
+        throw std::runtime_error("Could not open snapshot manifest: " + temp_path.string());
+    }
+    bool ok = std::fwrite(manifest_str.data(), 1, manifest_str.size(), manifest_file)
+            == manifest_str.size()
+        && std::fflush(manifest_file) == 0
+        && ::fsync(fileno(manifest_file)) == 0;
+    ok = std::fclose(manifest_file) == 0 && ok;
+    if (!ok) {
+        throw std::runtime_error("Could not write snapshot manifest");
+    }
+    std::filesystem::rename(temp_path, m_dir / MANIFEST_NAME);
+    sync_dir(m_dir);
+}
+
+void Snapshot::commit(int32_t high_water_mark, int32_t min_timestamp,
+    ReadProcess& read_proc)
+{
+    MergeReader merger;
+    if (m_base_path) {
+        merger.add_reader(std::make_unique<MmapFileReader>(*m_base_path));
+    }
+    for (const auto& path: m_delta_paths) {
+        merger.add_reader(std::make_unique<MmapFileReader>(path));
+    }
+
+    uint32_t generation = m_generation + 1;
+    auto base_path = m_dir / ("base_" + std::to_string(generation) + ".bin");
+    FileWriter writer(base_path);
+    BaseWriterReader base_reader(&merger, &writer, min_timestamp);
+    read_proc.process(base_reader);
+    writer.sync();
+    writer.close();
+    std::cout << "  snapshot has " << base_reader.m_row_count << " rows, dropped "
+        << base_reader.m_dropped_count << " old rows" << std::endl;
+
+    auto old_base_path = m_base_path;
+    m_generation = generation;
+    m_high_water_mark = high_water_mark;
+    m_base_path = base_path;
+    this->write_manifest();
+
+    if (old_base_path) {
+        std::filesystem::remove(*old_base_path);
+    }
+    for (const auto& path: m_delta_paths) {
+        std::filesystem::remove(path);
+    }
+    m_delta_paths.clear();
+}
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include "geosick/geo_row_reader.hpp"
+
+namespace geosick {
+
+class ReadProcess;
+
+// Copy of the positions that is kept in a directory between runs, sorted by
+// get_row_key(). Every run reads only the positions that were created since
+// the high-water mark of the previous run (the delta), merges them with the
+// stored base and drops the positions that are too old.
+class Snapshot {
+    std::filesystem::path m_dir;
+    size_t m_row_buffer_size;
+    size_t m_sort_threads;
+    uint32_t m_generation = 0;
+    std::optional<int32_t> m_high_water_mark;
+    std::optional<std::filesystem::path> m_base_path;
+
+    std::mutex m_mutex;
+    std::vector<std::filesystem::path> m_delta_paths;
+    uint32_t m_delta_counter = 0;
+
+    void write_delta(std::vector<GeoRow> rows);
+    void write_manifest();
+public:
+    Snapshot(std::filesystem::path dir, size_t row_buffer_size, size_t sort_threads);
+
+    // All positions created before this timestamp are in the snapshot
+    std::optional<int32_t> get_high_water_mark() const { return m_high_water_mark; }
+
+    // Sorts and stores the rows of the delta; may be called concurrently for
+    // multiple readers
+    void add_delta(GeoRowReader& reader);
+
+    // Merges the delta into the base, passes the rows that are not older than
+    // min_timestamp to read_proc and stores them as the new base
+    void commit(int32_t high_water_mark, int32_t min_timestamp, ReadProcess& read_proc);
+};
+
+}
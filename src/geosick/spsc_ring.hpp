@@ -0,0 +1,106 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace geosick {
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Threads that wait in push() or pop() spin briefly and then sleep
+// until the other side makes progress.
+template<class T>
+class SpscRing {
+    std::vector<T> m_slots;
+    size_t m_mask;
+    alignas(64) std::atomic<size_t> m_head { 0 };
+    alignas(64) std::atomic<size_t> m_tail { 0 };
+
+public:
+    explicit SpscRing(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) { size *= 2; }
+        m_slots.resize(size);
+        m_mask = size - 1;
+    }
+
+    // Moves the value into the ring, unless it is full
+    bool try_push(T& value) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) > m_mask) { return false; }
+        m_slots[tail & m_mask] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Moves the oldest value out of the ring, unless it is empty
+    bool try_pop(T& out_value) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) { return false; }
+        out_value = std::move(m_slots[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Pushes the value, waiting while the ring is full. Returns false if the
+    // stop flag was raised while waiting.
+    bool push(T& value, const std::atomic<bool>& stop) {
+        bool pushed = this->wait_until([&]() { return this->try_push(value); }, stop);
+        if (pushed) { this->notify(); }
+        return pushed;
+    }
+
+    // Pops a value, waiting while the ring is empty. Returns false if the stop
+    // flag was raised while waiting.
+    bool pop(T& out_value, const std::atomic<bool>& stop) {
+        bool popped = this->wait_until([&]() { return this->try_pop(out_value); }, stop);
+        if (popped) { this->notify(); }
+        return popped;
+    }
+
+    // Wakes up the threads that wait in push() or pop(), so that they notice
+    // that the stop flag was raised
+    void wake() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cond.notify_all();
+    }
+
+private:
+    // Number of attempts before a waiting thread goes to sleep
+    static constexpr size_t SPIN_COUNT = 64;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::atomic<size_t> m_sleeper_count { 0 };
+
+    template<class F>
+    bool wait_until(const F& try_op, const std::atomic<bool>& stop) {
+        for (size_t i = 0; i < SPIN_COUNT; ++i) {
+            if (try_op()) { return true; }
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_sleeper_count.fetch_add(1);
+        // pairs with the fence in notify(), so either we see the change of the
+        // other thread, or it sees us sleeping
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool done = false;
+        m_cond.wait(lock, [&]() {
+            done = try_op();
+            return done || stop.load();
+        });
+        m_sleeper_count.fetch_sub(1);
+        return done;
+    }
+
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleeper_count.load() > 0) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cond.notify_all();
+        }
+    }
+};
+
+}
@@ -0,0 +1,71 @@
+#include "geosick/thread_pool.hpp"
+
+namespace geosick {
+
+// Index of the worker that runs on the current thread, or SIZE_MAX if the
+// current thread does not belong to a pool
+static thread_local size_t this_worker_idx = SIZE_MAX;
+static thread_local const ThreadPool* this_worker_pool = nullptr;
+
+ThreadPool::ThreadPool(size_t thread_count) {
+    if (thread_count == 0) { thread_count = 1; }
+    for (size_t i = 0; i < thread_count; ++i) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+        m_threads.emplace_back(&ThreadPool::run_worker, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    for (auto& thread: m_threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::push_task(Task task) {
+    size_t worker_idx = this_worker_pool == this ? this_worker_idx
+        : m_next_worker.fetch_add(1) % m_workers.size();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_workers[worker_idx]->tasks.push_back(std::move(task));
+        m_pending_count += 1;
+    }
+    m_cond.notify_one();
+}
+
+// The mutex must be locked by the caller
+bool ThreadPool::pop_task(size_t worker_idx, Task& out_task) {
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        Worker& worker = *m_workers[(worker_idx + i) % m_workers.size()];
+        if (!worker.tasks.empty()) {
+            out_task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run_worker(size_t worker_idx) {
+    this_worker_idx = worker_idx;
+    this_worker_pool = this;
+    for (;;) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [&] { return m_stop || m_pending_count > 0; });
+            if (m_pending_count == 0) { break; }
+            this->pop_task(worker_idx, task);
+            m_pending_count -= 1;
+        }
+        task();
+    }
+}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace geosick {
+
+// Pool of threads where every worker owns a queue of tasks. Workers take the
+// oldest task from their own queue and steal the oldest tasks of other workers
+// when they run out of work, so tasks start roughly in the order in which they
+// were submitted. The queues are guarded by a single mutex, which also keeps
+// the count of pending tasks exact, so idle workers always sleep.
+class ThreadPool {
+    using Task = std::function<void()>;
+
+    struct Worker {
+        std::deque<Task> tasks;
+    };
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+    std::atomic<size_t> m_next_worker { 0 };
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    size_t m_pending_count = 0;
+    bool m_stop = false;
+
+    void push_task(Task task);
+    bool pop_task(size_t worker_idx, Task& out_task);
+    void run_worker(size_t worker_idx);
+public:
+    explicit ThreadPool(size_t thread_count);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t get_thread_count() const { return m_threads.size(); }
+
+    template<class F>
+    std::future<void> submit(F func) {
+        auto task = std::make_shared<std::packaged_task<void()>>(std::move(func));
+        auto future = task->get_future();
+        this->push_task([task]() { (*task)(); });
+        return future;
+    }
+};
+
+}